@@ -8,13 +8,26 @@ RESOURCES += \
 
 HEADERS += \
     view.h \
+    assetloader.h \
     outlinepainter.h \
+    glyphatlas.h \
+    textrenderer.h \
+    labelrenderer.h \
+    shadereffect.h \
     imageobject.h \
     imageviewer.h \
     directory.h \
     pickobject.h \
     room.h \
+    backgroundcache.h \
+    meshlod.h \
+    renderqueue.h \
+    geometryutil.h \
+    instancedmesh.h \
+    raypicker.h \
+    resourcemanager.h \
     common.h \
+    trace.h \
     lib/glview.h \
     lib/gldrawbuffersurface_p.h \
     lib/glmaskedsurface_p.h
@@ -22,7 +35,12 @@ HEADERS += \
 SOURCES += \
     main.cpp \
     view.cpp \
+    assetloader.cpp \
     outlinepainter.cpp \
+    glyphatlas.cpp \
+    textrenderer.cpp \
+    labelrenderer.cpp \
+    shadereffect.cpp \
     imageobject.cpp \
     imageviewer.cpp \
     directory.cpp \
@@ -30,10 +48,18 @@ SOURCES += \
     paint.cpp \
     control.cpp \
     room.cpp \
+    backgroundcache.cpp \
+    meshlod.cpp \
+    renderqueue.cpp \
+    geometryutil.cpp \
+    instancedmesh.cpp \
+    raypicker.cpp \
+    resourcemanager.cpp \
     animation.cpp \
     lib/glview.cpp \
     lib/gldrawbuffersurface.cpp \
     lib/glmaskedsurface.cpp \
-    config.cpp
+    config.cpp \
+    trace.cpp
 
 QMAKE_CXXFLAGS += -std=gnu++0x
@@ -1,7 +1,6 @@
 #include "view.h"
 #include "common.h"
 #include "room.h"
-#include <QtCore/QVariantAnimation>
 
 inline QVector3D rotateCcw(QVector3D vec, qreal angle)
 {
@@ -16,21 +15,38 @@ inline QVector3D rotateCcw(qreal x, qreal y, qreal z, qreal angle)
 void View::setupAnimation()
 {
     animStage = NoAnim;
+    animDuration = 1500;
+}
+
+void View::prepareFrame(qint64 msecs)
+{
+    if (benchDir) stepBenchmark();
+
+    if (movePending) {
+        applyingMove = true;
+        applyMouseMove();
+        applyingMove = false;
+    }
 
-    animation = new QVariantAnimation();
-    animation->setStartValue(QVariant(static_cast<qreal>(0.0)));
-    animation->setEndValue(QVariant(static_cast<qreal>(1.0)));
-    animation->setDuration(1500);
+    if (animStage == NoAnim) return;
 
-    connect(animation, &QVariantAnimation::valueChanged,
-            [=](const QVariant &var)
-            {
-                animProg = var.toReal();
-                update();
-            });
+    // the last frame of a stage is painted with full progress
+    if (animProg >= 1.0) {
+        finishAnimation();
+        if (animStage == NoAnim) return;
+    }
 
-    connect(animation, &QVariantAnimation::finished, this,
-            &View::finishAnimation);
+    // progress by the frame clock, so that it matches what is displayed
+    if (animStartTime < 0) animStartTime = msecs;
+    animProg = qMin((msecs - animStartTime) / qreal(animDuration), 1.0);
+    invalidate(CameraDirty | RoomDirty);
+}
+
+void View::runAnimation()
+{
+    animProg = 0.0;
+    animStartTime = -1;
+    invalidate(CameraDirty | RoomDirty);
 }
 
 void View::startAnimation(AnimStage stage)
@@ -47,6 +63,8 @@ void View::startAnimation(AnimStage stage)
         endCenter = curRoom->getEntryPos(enteringDir);
         endEye = endCenter + QVector3D(0, roomHeight * boxScale * 2, 0);
         deltaUp = QVector3D(0, -1, -1);
+        impostorValid = false;
+        impostorDone = false;
         break;
 
     case Entering2:
@@ -69,7 +87,11 @@ void View::startAnimation(AnimStage stage)
 
     case TurningLeft:
     case TurningRight:
-        animation->setDuration(500);
+        animDuration = 500;
+        break;
+
+    case SlidingPage:
+        animDuration = 300;
         break;
 
     default:
@@ -79,7 +101,7 @@ void View::startAnimation(AnimStage stage)
     animStage = stage;
     deltaCenter = endCenter - startCenter;
     deltaEye = endEye - startEye;
-    animation->start();
+    runAnimation();
 }
 
 void View::finishAnimation()
@@ -96,10 +118,10 @@ void View::finishAnimation()
         camera()->setCenter(defaultCenter);
         camera()->setEye(defaultEye);
         curRoom->switchBackAndFront();
+        curRoom->loadAdjacent(dir);
         animStage = NoAnim;
         enteringDir = -1;
-        updateHudContent();
-        update();
+        invalidate(RoomDirty | HudDirty);
         break;
 
     case Leaving1:
@@ -113,8 +135,9 @@ void View::finishAnimation()
         animStage = Leaving3;
         leavingDoor = -1;
         curRoom->switchBackAndFront();
-        updateHudContent();
-        animation->start();
+        curRoom->loadAdjacent(dir);
+        invalidate(HudDirty);
+        runAnimation();
         break;
 
     case Leaving3:
@@ -126,10 +149,21 @@ void View::finishAnimation()
     case TurningLeft:
     case TurningRight:
         animStage = NoAnim;
-        animation->setDuration(1500);
+        animDuration = 1500;
+        break;
+
+    case SlidingPage:
+        animStage = NoAnim;
+        animDuration = 1500;
+        curRoom->setPageSlide(0.0);
+        invalidate(RoomDirty);
         break;
 
     default:
         break;
     }
+
+    if (animStage == NoAnim)
+        while (!pendingReloads.isEmpty())
+            reloadConfig(pendingReloads.takeFirst());
 }
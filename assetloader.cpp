@@ -0,0 +1,67 @@
+#include "assetloader.h"
+#include "meshlod.h"
+#include "trace.h"
+#include <Qt3D/QGLAbstractScene>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QThread>
+
+#include <QtCore/QDebug>
+
+AssetLoader::AssetLoader()
+{
+    thread = new QThread;
+    moveToThread(thread);
+
+    connect(thread, &QThread::started, this, &AssetLoader::run);
+    connect(this, &AssetLoader::finished, thread, &QThread::quit);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+}
+
+void AssetLoader::addModel(const QString &fileName)
+{
+    if (!modelFiles.contains(fileName))
+        modelFiles.append(fileName);
+}
+
+void AssetLoader::addTexture(const QString &fileName)
+{
+    if (!textureFiles.contains(fileName))
+        textureFiles.append(fileName);
+}
+
+void AssetLoader::start()
+{
+    thread->start();
+}
+
+void AssetLoader::run()
+{
+    // textures first, they are small and make the room shell look right
+    for (const QString &fileName : textureFiles) {
+        TraceSpan span("decode " + fileName);
+        QImage image(fileName);
+        if (image.isNull())
+            qDebug() << "Failed to load texture" << fileName;
+        emit textureLoaded(fileName, image);
+    }
+
+    QThread *mainThread = QCoreApplication::instance()->thread();
+    for (const QString &fileName : modelFiles) {
+        TraceSpan span("load model " + fileName);
+        QGLAbstractScene *scene = QGLAbstractScene::loadScene(fileName);
+        if (!scene) {
+            qDebug() << "Failed to load model" << fileName;
+            continue;
+        }
+        {
+            TraceSpan span("lod " + fileName);
+            MeshLod::generate(scene->mainNode());
+        }
+        scene->moveToThread(mainThread);
+        emit modelLoaded(fileName, scene);
+    }
+
+    // hand the loader back so that it can be deleted from the main thread
+    moveToThread(mainThread);
+    emit finished();
+}
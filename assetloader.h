@@ -0,0 +1,60 @@
+#ifndef ASSETLOADER_H
+#define ASSETLOADER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QStringList>
+#include <QtGui/QImage>
+
+class QGLAbstractScene;
+class QThread;
+
+/**
+ * \brief Background loader for models and textures
+ *
+ * Decoding images and parsing model files takes most of the startup time,
+ * so they are done in a worker thread while the window is already shown.
+ *
+ * Requests are queued by loadConfig() and processed in order after start()
+ * is called. Results are delivered by queued signals, so slots connected to
+ * them run in the main thread and can safely touch the scene graph.
+ *
+ * No OpenGL calls are made in the worker thread, textures are uploaded
+ * lazily when they are bound for the first time.
+ */
+
+class AssetLoader : public QObject {
+    Q_OBJECT
+public:
+    AssetLoader();
+
+    /// Queue the model file @p fileName. Files already queued are skipped.
+    void addModel(const QString &fileName);
+
+    /// Queue the image file @p fileName. Files already queued are skipped.
+    void addTexture(const QString &fileName);
+
+    /// Start loading queued assets in the worker thread.
+    /// Requests added after this call are ignored.
+    void start();
+
+signals:
+    /// The model file @p fileName is parsed as @p scene.
+    /// The scene has been moved to the main thread.
+    void modelLoaded(const QString &fileName, QGLAbstractScene *scene);
+
+    /// The image file @p fileName is decoded as @p image.
+    void textureLoaded(const QString &fileName, const QImage &image);
+
+    /// All queued assets are loaded.
+    void finished();
+
+private slots:
+    void run();
+
+private:
+    QThread *thread;
+    QStringList modelFiles;
+    QStringList textureFiles;
+};
+
+#endif
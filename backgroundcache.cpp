@@ -0,0 +1,132 @@
+#include "backgroundcache.h"
+#include "common.h"
+#include "renderqueue.h"
+#include "resourcemanager.h"
+#include "room.h"
+#include "shadereffect.h"
+#include "trace.h"
+#include <Qt3D/QGLBuilder>
+#include <Qt3D/QGLFramebufferObjectSurface>
+#include <Qt3D/QGLLightParameters>
+#include <Qt3D/QGLPainter>
+#include <QtGui/QOpenGLFramebufferObject>
+#include <QtGui/QOpenGLShaderProgram>
+
+/* Size in pixels of each face */
+static const int FaceSize = 512;
+
+/* Look-at direction and up vector of faces, in the order of
+ * GL_TEXTURE_CUBE_MAP_POSITIVE_X + i */
+static const QVector3D FaceDir[6][2] = {
+    { QVector3D( 1,  0,  0), QVector3D(0, -1,  0) },
+    { QVector3D(-1,  0,  0), QVector3D(0, -1,  0) },
+    { QVector3D( 0,  1,  0), QVector3D(0,  0,  1) },
+    { QVector3D( 0, -1,  0), QVector3D(0,  0, -1) },
+    { QVector3D( 0,  0,  1), QVector3D(0, -1,  0) },
+    { QVector3D( 0,  0, -1), QVector3D(0, -1,  0) }
+};
+
+BackgroundCache::BackgroundCache()
+{
+    QGLBuilder builder;
+    builder.newSection(QGL::Faceted);
+    builder.addPane(QSizeF(2, 2));
+    node = builder.finalizedSceneNode();
+
+    node->setMaterial(new QGLMaterial());
+
+    effect = new ShaderEffect();
+    effect->setVertexShaderFromFile(":/shader/background.vsh");
+    effect->setFragmentShaderFromFile(":/shader/background.fsh");
+    node->setUserEffect(effect);
+}
+
+bool BackgroundCache::isValid(const Room *room, const QVector3D &eye) const
+{
+    return texture && room == this->room && eye == this->eye
+        && room->revision() == revision && resources.meshGeneration() == generation
+        && materialGeneration == materials;
+}
+
+void BackgroundCache::render(QGLPainter *painter, RenderQueue *queue, const Room *room,
+        const QVector3D &eye, const QGLLightParameters *light)
+{
+    TraceSpan span("render background " + room->configFile());
+
+    if (!texture) {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        for (int i = 0; i < 6; ++i)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA,
+                    FaceSize, FaceSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        fbo = new QOpenGLFramebufferObject(FaceSize, FaceSize, QOpenGLFramebufferObject::CombinedDepthStencil);
+        surface = new QGLFramebufferObjectSurface(fbo);
+    }
+
+    // light at the same place as seen in the default direction
+    QMatrix4x4 lightTrans;
+    lightTrans.translate(eye);
+
+    painter->modelViewMatrix().push();
+    painter->projectionMatrix().push();
+    painter->projectionMatrix().setToIdentity();
+    painter->projectionMatrix().perspective(90, 1, roomLength / 2 * 0.015, roomWidth * 50);
+
+    painter->pushSurface(surface);
+    for (int i = 0; i < 6; ++i) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        QMatrix4x4 view;
+        view.lookAt(eye, eye + FaceDir[i][0], FaceDir[i][1]);
+        painter->modelViewMatrix() = view;
+        int lightId = painter->addLight(light, view * lightTrans);
+
+        room->queueShell(queue, painter);
+        queue->flush(painter);
+
+        painter->removeLight(lightId);
+
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        glCopyTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, 0, 0, FaceSize, FaceSize);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    }
+    painter->popSurface();
+
+    painter->modelViewMatrix().pop();
+    painter->projectionMatrix().pop();
+
+    this->room = room;
+    this->eye = eye;
+    revision = room->revision();
+    generation = resources.meshGeneration();
+    materials = materialGeneration;
+}
+
+void BackgroundCache::draw(QGLPainter *painter)
+{
+    QGLAbstractEffect *prevEffect = painter->userEffect();
+    QMatrix4x4 inverse = painter->combinedMatrix().inverted();
+
+    painter->setUserEffect(effect);
+    effect->program()->setUniformValue("inverseMatrix", inverse);
+    effect->program()->setUniformValue("eye", eye);
+    effect->program()->setUniformValue("cubeMap", 0);
+
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+
+    node->draw(painter);
+
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_TEST);
+
+    painter->setUserEffect(prevEffect);
+}
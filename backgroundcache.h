@@ -0,0 +1,62 @@
+#ifndef BACKGROUNDCACHE_H
+#define BACKGROUNDCACHE_H
+
+#include <QtGui/QVector3D>
+#include <QtGui/qopengl.h>
+
+class QGLLightParameters;
+class QGLPainter;
+class QGLSceneNode;
+class QGLFramebufferObjectSurface;
+class QOpenGLFramebufferObject;
+class RenderQueue;
+class Room;
+class ShaderEffect;
+
+/**
+ * \brief Cube map of the static parts of a room seen from the eye
+ *
+ * While roaming or turning, only the camera center changes, so walls,
+ * static solids, floor and ceil look the same from the eye. They are
+ * rendered once into the six faces of a cube map, then each frame only
+ * a screen quad sampling the cube map is drawn behind the moving items.
+ *
+ * The faces are rendered into a framebuffer and copied to the cube map,
+ * because QOpenGLFramebufferObject cannot attach a cube map face.
+ * The cube map is rendered again when the eye, the room, its config,
+ * the loaded meshes or the textures of materials change.
+ *
+ * The light follows the camera in the normal view. Here it is placed
+ * where it is when looking straight ahead, so shading differs slightly
+ * from the normal view when looking up or down.
+ */
+
+class BackgroundCache {
+public:
+    BackgroundCache();
+
+    /// Return true if the cube map shows @p room from @p eye as it is now.
+    bool isValid(const Room *room, const QVector3D &eye) const;
+
+    /// Render the static parts of @p room seen from @p eye into the cube
+    /// map, lit by @p light. The lights of @p painter must be removed.
+    void render(QGLPainter *painter, RenderQueue *queue, const Room *room,
+            const QVector3D &eye, const QGLLightParameters *light);
+
+    /// Fill the screen with the cube map, without writing depth.
+    void draw(QGLPainter *painter);
+
+private:
+    QGLSceneNode *node;
+    ShaderEffect *effect;
+    GLuint texture = 0;
+    QOpenGLFramebufferObject *fbo = nullptr;
+    QGLFramebufferObjectSurface *surface = nullptr;
+
+    // what the cube map shows
+    const Room *room = nullptr;
+    QVector3D eye;
+    int revision = -1, generation = -1, materials = -1;
+};
+
+#endif
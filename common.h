@@ -1,6 +1,7 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QHash>
 #include <QtGui/QColor>
 
@@ -16,6 +17,8 @@ const char configDir[] = "config/";
 const char dataDir[] = "data/";
 #endif
 
+extern QElapsedTimer startupTimer;
+
 extern int windowWidth;
 extern int windowHeight;
 
@@ -27,13 +30,26 @@ extern qreal boxScale;
 
 extern QHash<QString, QGLMaterial*> palette;
 extern QHash<QString, QGLSceneNode*> models;
+extern int materialGeneration;  // changed when a material gets its texture
 extern QHash<QString, Room*> rooms;
 
 extern QList<QStringList> typeFilters;
 extern QStringList typeNameList;
 extern QHash<QString, int> extToIndex;
 
-enum AnimStage : int { NoAnim = 0, Entering1, Entering2, Leaving1, Leaving2, Leaving3, TurningLeft, TurningRight };
-enum { MaxEntryCnt = 100, TrashBin, Door, LeftArrow, RightArrow, MusicPlayer, Image, ImagePrevBtn, ImageNextBtn };
+enum AnimStage : int { NoAnim = 0, Entering1, Entering2, Leaving1, Leaving2, Leaving3, TurningLeft, TurningRight, SlidingPage };
+/* Object ids are a kind in the high byte and an index within the kind,
+ * or -1 for none, so each kind has its own range of 2^24 ids */
+enum ObjectKind : int { EntryKind = 0, SolidKind, ButtonKind };
+const int ObjectKindShift = 24;
+
+inline int objectId(ObjectKind kind, int index) { return kind << ObjectKindShift | index; }
+inline ObjectKind objectKind(int id) { return ObjectKind(id >> ObjectKindShift); }
+inline int objectIndex(int id) { return id & ((1 << ObjectKindShift) - 1); }
+
+enum {
+    TrashBin = SolidKind << ObjectKindShift, Door, LeftArrow, RightArrow, MusicPlayer, Image,
+    ImagePrevBtn = ButtonKind << ObjectKindShift, ImageNextBtn
+};
 
 #endif
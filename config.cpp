@@ -1,5 +1,8 @@
 #include "common.h"
+#include "assetloader.h"
+#include "resourcemanager.h"
 #include "room.h"
+#include "trace.h"
 #include <Qt3D/QGLAbstractScene>
 #include <QtGui/QImage>
 #include <QtCore/QFile>
@@ -11,17 +14,42 @@ qreal boxScale;
 
 QHash<QString, QGLMaterial*> palette;
 QHash<QString, QGLSceneNode*> models;
+int materialGeneration = 0;
 QHash<QString, Room*> rooms;
 
 QList<QStringList> typeFilters;
 QStringList typeNameList;
 QHash<QString, int> extToIndex;
 
-void loadConfig(const QString &fileName);
+// file names of assets waiting for the loader, keyed by material / model name
+static QHash<QString, QString> textureFiles;
+static QHash<QString, QString> modelFiles;
+
+static AssetLoader *loader;
+
+void loadConfig(const QString &fileName, AssetLoader *assetLoader);
 void loadProperty(const QString &property, QTextStream &value);
+QGLTexture2D *installTexture(const QString &fileName, const QImage &image);
+void installModel(const QString &fileName, QGLAbstractScene *scene);
+
+/* Shared by all materials whose texture is not loaded yet */
+static QGLTexture2D *placeholderTexture()
+{
+    static QGLTexture2D *tex = NULL;
+    if (!tex) {
+        QImage image(1, 1, QImage::Format_ARGB32);
+        image.fill(Qt::white);
+        tex = new QGLTexture2D();
+        tex->setImage(image);
+    }
+    return tex;
+}
 
-void loadConfig(const QString &fileName)
+void loadConfig(const QString &fileName, AssetLoader *assetLoader)
 {
+    loader = assetLoader;
+    TraceSpan span("parse " + fileName);
+
     QFile file(configDir + fileName);
     file.open(QIODevice::ReadOnly);
     QString line, property;
@@ -49,10 +77,11 @@ void loadProperty(const QString &property, QTextStream &value) {
         value >> name >> file;
 
         if (file != "-") {
-            QGLTexture2D *tex = new QGLTexture2D();
-            tex->setImage(QImage(dataDir + file));
-            mat->setTexture(tex);
+            // the real texture is set by installTexture()
+            mat->setTexture(placeholderTexture());
             mat->setTextureCombineMode(QGLMaterial::Decal);
+            textureFiles.insert(name, dataDir + file);
+            loader->addTexture(dataDir + file);
         }
 
         int r, g, b;
@@ -63,18 +92,25 @@ void loadProperty(const QString &property, QTextStream &value) {
 
         palette.insert(name, mat);
 
+    } else if (property == "budget") {
+        qint64 megabytes; value >> megabytes;
+        resources.setBudget(megabytes * 1024 * 1024);
+
     } else if (property == "size") {
         value >> roomWidth >> roomLength >> roomHeight >> eyeHeight >> boxScale;
 
     } else if (property == "room") {
         QString name; value >> name;
+        TraceSpan span("Room " + name);
         rooms.insert(name, new Room(name + ".conf"));
 
     } else if (property == "model") {
         QString name, fileName;
         value >> name >> fileName;
-        QGLAbstractScene *model = QGLAbstractScene::loadScene(dataDir + fileName);
-        models.insert(name, model->mainNode());
+        // an empty node until the loader delivers the mesh, see installModel()
+        models.insert(name, new QGLSceneNode());
+        modelFiles.insert(name, dataDir + fileName);
+        loader->addModel(dataDir + fileName);
 
     } else if (property == "filetype") {
         QString type, ext;
@@ -93,3 +129,24 @@ void loadProperty(const QString &property, QTextStream &value) {
     } else
         qDebug() << "Unknown property" << property;
 }
+
+QGLTexture2D *installTexture(const QString &fileName, const QImage &image)
+{
+    if (image.isNull()) return NULL;
+
+    // one reference for each material using the file
+    QGLTexture2D *tex = NULL;
+    for (const QString &name : textureFiles.keys(fileName)) {
+        tex = tex ? resources.acquireTexture(fileName)
+            : resources.acquireTexture(fileName, image);
+        palette[name]->setTexture(tex);
+    }
+    if (tex) ++materialGeneration;
+    return tex;
+}
+
+void installModel(const QString &fileName, QGLAbstractScene *scene)
+{
+    for (const QString &name : modelFiles.keys(fileName))
+        models[name]->addNode(resources.acquireMesh(fileName, scene));
+}
@@ -1,6 +1,10 @@
 #include "view.h"
 #include "common.h"
 #include "directory.h"
+#include "outlinepainter.h"
+#include "raypicker.h"
+#include "renderqueue.h"
+#include "resourcemanager.h"
 #include "room.h"
 #include <QtGui/QDesktopServices>
 #include <QtGui/QMouseEvent>
@@ -27,7 +31,7 @@ void View::invokeObject(int id)
         case TrashBin:
             if (dir->remove(pickedEntry)) {
                 curRoom->loadFront(dir);
-                update();
+                invalidate(RoomDirty);
             }
             hoverLeave();
             break;
@@ -41,6 +45,7 @@ void View::invokeObject(int id)
 
         case Image:
             curRoom->setImage(dir->playFile(pickedEntry, "image"));
+            invalidate(ImageDirty);
             break;
         }
 
@@ -56,15 +61,11 @@ void View::invokeObject(int id)
             break;
 
         case LeftArrow:
-            dir->prevPage();
-            curRoom->loadFront(dir);
-            update();
+            turnPage(-1);
             break;
 
         case RightArrow:
-            dir->nextPage();
-            curRoom->loadFront(dir);
-            update();
+            turnPage(1);
             break;
 
         case Image:
@@ -73,10 +74,12 @@ void View::invokeObject(int id)
 
         case ImagePrevBtn:
             curRoom->setImage(dir->playPrev("image"));
+            invalidate(ImageDirty);
             break;
 
         case ImageNextBtn:
             curRoom->setImage(dir->playNext("image"));
+            invalidate(ImageDirty);
             break;
 
         case MusicPlayer:
@@ -101,14 +104,29 @@ void View::openEntry(int index)
         openFile(dir->absoluteFilePath(index));
 }
 
+void View::turnPage(int delta)
+{
+    if (!(delta > 0 ? dir->nextPage() : dir->prevPage())) return;
+
+    // the page is already built, only the next one is loaded
+    curRoom->turnPage(delta, dir);
+    if (slidePages) {
+        slideDelta = delta;
+        startAnimation(SlidingPage);
+    } else
+        invalidate(RoomDirty);
+}
+
 void View::mousePressEvent(QMouseEvent *event)
 {
     if (animStage != NoAnim || event->button() != Qt::LeftButton) return;
-    int obj = objectIdForPoint(event->pos());
+    if (movePending) applyMouseMove();
+    int obj = objectAt(event->pos());
 
-    if (obj >= 0 && obj < dir->count()) {
+    if (objectKind(obj) == EntryKind && obj < dir->count()) {
         pickedEntry = obj;
         curRoom->pickEntry(obj);
+        invalidate(PickedDirty);
         QMatrix4x4 mvp = calcMvp(camera(), size());
         pickedDepth = (mvp * curRoom->getEntryPos(pickedEntry)).z();
         pickedPos = mvp.inverted() * extendTo3D(event->pos(), pickedDepth);
@@ -125,6 +143,7 @@ void View::mousePressEvent(QMouseEvent *event)
 void View::mouseReleaseEvent(QMouseEvent *event)
 {
     if (animStage != NoAnim || event->button() != Qt::LeftButton) return;
+    if (movePending) applyMouseMove();
 
     if (isRoaming) {
         isRoaming = false;
@@ -135,56 +154,119 @@ void View::mouseReleaseEvent(QMouseEvent *event)
         openEntry(pickedEntry);
 
     else {
-        int id = objectIdForPoint(event->pos());
-        if (id > dir->count())
+        int id = objectAt(event->pos());
+        if (id != -1 && objectKind(id) != EntryKind)
             invokeObject(id);
     }
 
     pickedEntry = -1;
     curRoom->pickEntry(-1);
-    update();
+    invalidate(RoomDirty | PickedDirty);
 }
 
 void View::mouseMoveEvent(QMouseEvent *event)
 {
     if (animStage != NoAnim) return;
 
+    // applied once per frame by prepareFrame, at the latest position
+    ++moveEvents;
+    if (movePending)
+        ++mergedMoves;
+    else
+        update();
+    movePending = true;
+    movePos = event->pos();
+}
+
+void View::applyMouseMove()
+{
+    movePending = false;
+    if (animStage != NoAnim) return;
+
+    QMatrix4x4 inverse = calcMvp(camera(), size()).inverted();
+
     if (isRoaming) {
         /* FIXME: moving mouse outside window may cause strange behaviour */
         /* The bug is caused by center() - eye() == (0, y, 0), which is parallel to up vector */
-        QVector3D moveVector = (calcMvp(camera(), size()).inverted() * QVector4D(event->pos() - roamStartPos)).toVector3D();
+        QVector3D moveVector = (inverse * QVector4D(movePos - roamStartPos)).toVector3D();
         QQuaternion rotation = QQuaternion::fromAxisAndAngle(QVector3D::crossProduct(roamStartCenter, -moveVector), moveVector.length() * 40);
         camera()->setCenter(rotation.rotatedVector(roamStartCenter - QVector3D(0, eyeHeight, 0)) + QVector3D(0, eyeHeight, 0));
         return;
     }
 
-    int obj = objectIdForPoint(event->pos());
+    // with the pick buffer, answered by objectIdReady without waiting for the GPU
+    if (gpuPicking)
+        requestObjectId(movePos);
+    else
+        objectIdReady(movePos, castPickRay(movePos));
+
+    if (pickedEntry != -1) {
+        /* move picked object */
+        deltaPos = inverse * extendTo3D(movePos, pickedDepth) - pickedPos;
+        invalidate(PickedDirty);
+        return;
+    }
+}
+
+void View::objectIdReady(const QPoint &, int obj)
+{
+    if (animStage != NoAnim || isRoaming) return;
+
     if (obj != hoveringId) {
         hoverLeave();
         hoverEnter(obj);
     }
+}
 
-    if (pickedEntry != -1) {
-        /* move picked object */
-        deltaPos = calcMvp(camera(), size()).inverted()
-            * extendTo3D(event->pos(), pickedDepth)
-            - pickedPos;
-        update();
-        return;
+int View::objectAt(const QPoint &point)
+{
+    return gpuPicking ? objectIdForPoint(point) : castPickRay(point);
+}
+
+void View::updatePicker()
+{
+    // triangles are kept by node, which may be gone after
+    // the room is reloaded or models are loaded
+    if (curRoom != pickerRoom || curRoom->revision() != pickerRevision
+            || resources.meshGeneration() != pickerGeneration) {
+        picker->clearMeshes();
+        pickerRoom = curRoom;
+        pickerRevision = curRoom->revision();
+        pickerGeneration = resources.meshGeneration();
+        pickerDirty = true;
+    }
+    if (pickerDirty) {
+        picker->clear();
+        curRoom->addToPicker(picker);
+        pickerDirty = false;
     }
 }
 
+/* Cast a ray through the center of the pixel at @p point,
+ * as sampled in the pick buffer */
+int View::castPickRay(const QPoint &point)
+{
+    if (point.x() < 0 || point.x() >= width() || point.y() < 0 || point.y() >= height())
+        return -1;
+
+    updatePicker();
+
+    // from the near plane to the far plane
+    QMatrix4x4 inverse = calcMvp(camera(), size()).inverted();
+    qreal x = point.x() + 0.5, y = point.y() + 0.5;
+    return picker->pick(inverse * QVector3D(x, y, -1), inverse * QVector3D(x, y, 1));
+}
+
 void View::hoverEnter(int obj) {
     if (obj == -1) return;
     hoveringId = obj;
-    update();
+    invalidate(HoverDirty);
 }
 
 void View::hoverLeave() {
     if (hoveringId == -1) return;
     hoveringId = -1;
-    updateHudContent();
-    update();
+    invalidate(HoverDirty | HudDirty);
 }
 
 void View::keyPressEvent(QKeyEvent *event) {
@@ -192,7 +274,7 @@ void View::keyPressEvent(QKeyEvent *event) {
     switch (event->key()) {
     case Qt::Key_Tab:
         setOption(GLView::ShowPicking, !(options() & GLView::ShowPicking));
-        update();
+        invalidate(AllDirty);
         break;
 
     case Qt::Key_Left:
@@ -202,10 +284,7 @@ void View::keyPressEvent(QKeyEvent *event) {
 
     case Qt::Key_Up:
         hoverLeave();
-        dir->prevPage();
-
-        curRoom->loadFront(dir);
-        update();
+        turnPage(-1);
         break;
 
     case Qt::Key_Right:
@@ -215,10 +294,7 @@ void View::keyPressEvent(QKeyEvent *event) {
 
     case Qt::Key_Down:
         hoverLeave();
-        dir->nextPage();
-
-        curRoom->loadFront(dir);
-        update();
+        turnPage(1);
         break;
 
     case Qt::Key_D:
@@ -228,7 +304,7 @@ void View::keyPressEvent(QKeyEvent *event) {
         camera()->setNearPlane(roomLength / 2 * 0.015);
         camera()->setFarPlane(roomLength / 2 * 50);
         camera()->setUpVector(QVector3D(0, 1, 0));
-        update();
+        invalidate(CameraDirty);
         break;
 
     case Qt::Key_R:
@@ -238,14 +314,59 @@ void View::keyPressEvent(QKeyEvent *event) {
         camera()->setNearPlane(roomLength / 2 * 0.015);
         camera()->setFarPlane(roomLength / 2 * 50);
         camera()->setUpVector(QVector3D(0, 1, 0));
-        update();
+        invalidate(CameraDirty);
+        break;
+
+    case Qt::Key_B:
+        backgroundCached = !backgroundCached;
+        qDebug() << "Background cache" << (backgroundCached ? "on" : "off");
+        invalidate(SceneDirty);
+        break;
+
+    case Qt::Key_G:
+        gpuPicking = !gpuPicking;
+        qDebug() << "Picking on" << (gpuPicking ? "GPU" : "CPU");
+        break;
+
+    case Qt::Key_J:
+        outline->setMode(outline->getMode() == OutlinePainter::Blur ?
+                OutlinePainter::JumpFlood : OutlinePainter::Blur);
+        qDebug() << "Outline by" << (outline->getMode() == OutlinePainter::Blur ? "blur" : "jump flood");
+        invalidate(HoverDirty);
+        break;
+
+    case Qt::Key_P:
+        slidePages = !slidePages;
+        qDebug() << "Page slide" << (slidePages ? "on" : "off");
+        break;
+
+    case Qt::Key_O:
+        outline->setHalfResolution(!outline->isHalfResolution());
+        qDebug() << "Outline at" << (outline->isHalfResolution() ? "half" : "full") << "resolution";
+        invalidate(HoverDirty);
+        break;
+
+    case Qt::Key_L:
+        showLabels = !showLabels;
+        qDebug() << "Labels" << (showLabels ? "on" : "off");
+        invalidate(RoomDirty);
+        break;
+
+    case Qt::Key_M:
+        qDebug() << "Resources:" << resources.residency();
+        break;
+
+    case Qt::Key_S:
+        qDebug() << "Last frame:" << queue->stats();
+        qDebug() << "Mouse moves:" << moveEvents << "merged:" << mergedMoves;
+        qDebug() << "Outline GPU time:" << outline->stats();
         break;
 
     case Qt::Key_U:
         if (dir->cdUp()) {
             hoverLeave();
             curRoom->loadFront(dir);
-            update();
+            invalidate(RoomDirty);
         }
         break;
     }
@@ -12,7 +12,7 @@ Directory::Directory(int size) : QDir(), playingFiles(typeNameList.size())
     setFilter(QDir::AllEntries | QDir::NoDotAndDotDot);
     setSorting(QDir::IgnoreCase);
 
-    pageSize = size;
+    pageSize = qMax(size, 0);
     update();
 }
 
@@ -51,15 +51,25 @@ bool Directory::cdUp()
     return success;
 }
 
+void Directory::setPageSize(int size)
+{
+    // a room without slots has empty pages
+    pageSize = qMax(size, 0);
+    if (pageSize == 0)
+        offset = 0;
+    else
+        offset -= offset % pageSize;
+}
+
 void Directory::refresh()
 {
     int tmp = offset;
     QDir::refresh();
     update();
     offset = tmp;
-    while (offset >= (int)QDir::count())
+    while (pageSize > 0 && offset >= (int)QDir::count())
         offset -= pageSize;
-    if (offset < 0) offset = 0;
+    if (offset < 0 || pageSize == 0) offset = 0;
 }
 
 bool Directory::remove(int index)
@@ -85,17 +95,20 @@ bool Directory::remove(int index)
     return false;
 }
 
-void Directory::nextPage()
+bool Directory::nextPage()
 {
+    if (pageSize == 0 || offset + pageSize >= (int)QDir::count())
+        return false;
     offset += pageSize;
-    if (offset >= (int)QDir::count())
-        offset -= pageSize;
+    return true;
 }
 
-void Directory::prevPage()
+bool Directory::prevPage()
 {
-    if (offset > 0)
-        offset -= pageSize;
+    if (pageSize == 0 || offset <= 0)
+        return false;
+    offset -= pageSize;
+    return true;
 }
 
 QString Directory::playFile(int index, const QString &assumedType)
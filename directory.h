@@ -37,9 +37,16 @@ public:
     bool cdUp();
 
     /// Move to next page. Do nothing when reach the end.
-    void nextPage();
+    /// Return true if moved, false otherwise.
+    bool nextPage();
     /// Move to previous page. Do nothing when reach the beginning.
-    void prevPage();
+    /// Return true if moved, false otherwise.
+    bool prevPage();
+
+    /// Change the page size to @p size, e.g. when slots of room changed.
+    /// Stay at the page containing the first entry of current page.
+    /// With a size of 0 (a room without slots) all pages are empty.
+    void setPageSize(int size);
 
     /// Reload current page.
     /// Use this function when the content is modified by other programs.
@@ -83,6 +90,24 @@ public:
         return typeList.mid(offset, pageSize);
     }
 
+    /// Return type id for all entries of the page @p delta pages away from
+    /// current one, or an empty list if there is no such page.
+    inline QVector<int> adjacentTypeList(int delta) const
+    {
+        int start = offset + delta * pageSize;
+        if (start < 0 || start >= typeList.size()) return QVector<int>();
+        return typeList.mid(start, pageSize);
+    }
+
+    /// Return the names of all entries of the page @p delta pages away from
+    /// current one (0 for current page), or an empty list if there is no such page.
+    inline QStringList entryNameList(int delta = 0) const
+    {
+        int start = offset + delta * pageSize;
+        if (start < 0 || start >= entryList.size()) return QStringList();
+        return entryList.mid(start, pageSize);
+    }
+
     /// Return the absolute path of a file in directory.
     /// Does not check if the file actually exists.
     inline QString absoluteFilePath(const QString &fileName) const
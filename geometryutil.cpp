@@ -0,0 +1,102 @@
+#include "geometryutil.h"
+#include <Qt3D/QGLSceneNode>
+
+static void collectParts(QGLSceneNode *node, const QMatrix4x4 &parentTransform,
+        const MeshPart &inherited, QList<MeshPart> &parts)
+{
+    MeshPart part = inherited;
+    part.transform = parentTransform * node->transform();
+    if (node->material())
+        part.material = node->material();
+    if (node->hasEffect()) {
+        part.hasEffect = true;
+        part.effect = node->effect();
+        part.userEffect = node->userEffect();
+    }
+
+    if (node->count() > 0 && node->geometry().count() > 0) {
+        part.node = node;
+        part.geometry = node->geometry();
+        part.start = node->start();
+        part.count = node->count();
+        part.mode = node->drawingMode();
+        parts.append(part);
+    }
+
+    for (QGLSceneNode *child : node->children())
+        collectParts(child, part.transform, part, parts);
+}
+
+QList<MeshPart> collectParts(QGLSceneNode *node, const QMatrix4x4 &transform)
+{
+    MeshPart root{NULL, QGeometryData(), 0, 0, QGL::Triangles, QMatrix4x4(),
+            NULL, false, QGL::FlatColor, NULL};
+    QList<MeshPart> parts;
+    collectParts(node, transform, root, parts);
+    return parts;
+}
+
+/* Parts can be merged if they are drawn in the same way */
+static bool sameState(const MeshPart &a, const MeshPart &b)
+{
+    return a.material == b.material && a.hasEffect == b.hasEffect
+        && (!a.hasEffect || (a.effect == b.effect && a.userEffect == b.userEffect));
+}
+
+QGLSceneNode *mergeParts(const QList<MeshPart> &parts)
+{
+    // first part of each group, and the merged geometry
+    QList<MeshPart> states;
+    QList<QGeometryData> merged;
+
+    for (const MeshPart &part : parts) {
+        if (part.mode != QGL::Triangles) continue;
+
+        int group = 0;
+        while (group < states.size() && !sameState(states.at(group), part)) ++group;
+        if (group == states.size()) {
+            states.append(part);
+            merged.append(QGeometryData());
+        }
+        QGeometryData &data = merged[group];
+
+        QMatrix4x4 normalTransform = part.transform.inverted().transposed();
+        bool hasNormal = part.geometry.hasField(QGL::Normal);
+        bool hasTexCoord = part.geometry.hasField(QGL::TextureCoord0);
+        QGL::IndexArray indices = part.geometry.indices();
+
+        // copy vertices in the range once, in order of first use
+        QHash<int, int> newIndex;
+        for (int i = part.start; i < part.start + part.count; ++i) {
+            int v = indices.at(i);
+            auto it = newIndex.find(v);
+            if (it == newIndex.end()) {
+                it = newIndex.insert(v, data.count());
+                data.appendVertex(part.transform * part.geometry.vertexAt(v));
+                data.appendNormal(hasNormal ?
+                        normalTransform.mapVector(part.geometry.normalAt(v)).normalized() :
+                        QVector3D(0, 1, 0));
+                data.appendTexCoord(hasTexCoord ? part.geometry.texCoordAt(v) : QVector2D());
+            }
+            data.appendIndex(*it);
+        }
+    }
+
+    if (states.isEmpty()) return NULL;
+
+    QGLSceneNode *root = new QGLSceneNode();
+    for (int i = 0; i < states.size(); ++i) {
+        const MeshPart &state = states.at(i);
+        QGLSceneNode *node = new QGLSceneNode(root);
+        node->setGeometry(merged.at(i));
+        node->setCount(merged.at(i).indexCount());
+        node->setMaterial(state.material);
+        if (state.hasEffect) {
+            if (state.userEffect)
+                node->setUserEffect(state.userEffect);
+            else
+                node->setEffect(state.effect);
+        }
+    }
+    return root;
+}
@@ -0,0 +1,41 @@
+#ifndef GEOMETRYUTIL_H
+#define GEOMETRYUTIL_H
+
+#include <Qt3D/QGeometryData>
+#include <QtCore/QList>
+#include <QtGui/QMatrix4x4>
+
+class QGLAbstractEffect;
+class QGLMaterial;
+class QGLSceneNode;
+
+/**
+ * \brief A drawable piece of a scene node tree
+ *
+ * The geometry range of a node, together with the transform, material
+ * and effect it would be drawn with (inherited from ancestors).
+ */
+
+struct MeshPart {
+    QGLSceneNode *node;
+    QGeometryData geometry;
+    int start, count;
+    QGL::DrawingMode mode;
+    QMatrix4x4 transform;
+    QGLMaterial *material;
+    bool hasEffect;
+    QGL::StandardEffect effect;
+    QGLAbstractEffect *userEffect;
+};
+
+/// Flatten the tree of @p node to the parts that have geometry,
+/// with @p transform applied to the whole tree.
+QList<MeshPart> collectParts(QGLSceneNode *node, const QMatrix4x4 &transform = QMatrix4x4());
+
+/// Merge triangle @p parts sharing material and effect into one node each,
+/// with transforms applied to vertices and normals.
+/// Return a node containing the merged nodes, or NULL if parts is empty.
+/// Parts of other drawing modes are not supported and skipped.
+QGLSceneNode *mergeParts(const QList<MeshPart> &parts);
+
+#endif
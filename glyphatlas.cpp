@@ -0,0 +1,108 @@
+#include "glyphatlas.h"
+#include "resourcemanager.h"
+#include <Qt3D/QGeometryData>
+#include <Qt3D/QGLTexture2D>
+#include <QtCore/qmath.h>
+#include <QtGui/QFontMetricsF>
+#include <QtGui/QMatrix4x4>
+#include <QtGui/QVector2D>
+
+GlyphAtlas::GlyphAtlas(const QString &key, const QFont &font, int size, int padding,
+        QImage::Format format, Rasterizer rasterize) :
+    key(key), font(font), padding(padding), rasterize(rasterize),
+    image(size, size, format)
+{
+    clear();
+}
+
+GlyphAtlas::~GlyphAtlas()
+{
+    resources.releaseTexture(tex);
+}
+
+void GlyphAtlas::clear()
+{
+    glyphs.clear();
+    image.fill(Qt::transparent);
+    cursorX = cursorY = rowHeight = 0;
+    changed = true;
+    ++clearCount;
+}
+
+QGLTexture2D *GlyphAtlas::texture()
+{
+    if (changed) {
+        // the same texture is reused with new content
+        QGLTexture2D *prevTex = tex;
+        tex = resources.acquireTexture(key, image);
+        resources.releaseTexture(prevTex);
+        changed = false;
+    }
+    return tex;
+}
+
+/* Return the glyph of @p c, drawn into the atlas if new,
+ * or NULL if the atlas is full */
+const GlyphAtlas::Glyph *GlyphAtlas::glyph(QChar c)
+{
+    auto it = glyphs.constFind(c);
+    if (it != glyphs.constEnd()) return &*it;
+
+    QFontMetricsF metrics(font);
+    QRectF bounds = metrics.boundingRect(c).adjusted(-padding, -padding, padding, padding);
+    int width = qCeil(bounds.width()), height = qCeil(bounds.height());
+
+    // rows of glyphs from top to bottom
+    if (cursorX + width > image.width()) {
+        cursorX = 0;
+        cursorY += rowHeight;
+        rowHeight = 0;
+    }
+    if (cursorY + height > image.height()) return NULL;
+
+    rasterize(image, QRect(cursorX, cursorY, width, height), font, c,
+            QPointF(cursorX - bounds.left(), cursorY - bounds.top()));
+
+    Glyph glyph;
+    glyph.quad = QRectF(bounds.topLeft(), QSizeF(width, height));
+    glyph.uv = QRectF(qreal(cursorX) / image.width(), qreal(cursorY) / image.height(),
+            qreal(width) / image.width(), qreal(height) / image.height());
+    glyph.advance = metrics.width(c);
+
+    cursorX += width;
+    rowHeight = qMax(rowHeight, height);
+    changed = true;
+
+    return &*glyphs.insert(c, glyph);
+}
+
+bool GlyphAtlas::appendText(QGeometryData &geometry, const QString &text, QPointF pen,
+        const QMatrix4x4 &transform)
+{
+    bool complete = true;
+
+    for (QChar c : text) {
+        const Glyph *g = glyph(c);
+        if (!g) {
+            complete = false;
+            continue;
+        }
+        QRectF quad = g->quad.translated(pen);
+        pen.rx() += g->advance;
+
+        // t of texture coordinates starts from the bottom of the image
+        int first = geometry.count();
+        geometry.appendVertex(transform * QVector3D(quad.left(), quad.bottom(), 0),
+                transform * QVector3D(quad.right(), quad.bottom(), 0),
+                transform * QVector3D(quad.right(), quad.top(), 0),
+                transform * QVector3D(quad.left(), quad.top(), 0));
+        geometry.appendTexCoord(QVector2D(g->uv.left(), 1 - g->uv.bottom()));
+        geometry.appendTexCoord(QVector2D(g->uv.right(), 1 - g->uv.bottom()));
+        geometry.appendTexCoord(QVector2D(g->uv.right(), 1 - g->uv.top()));
+        geometry.appendTexCoord(QVector2D(g->uv.left(), 1 - g->uv.top()));
+        geometry.appendIndices(first, first + 1, first + 2);
+        geometry.appendIndices(first, first + 2, first + 3);
+    }
+
+    return complete;
+}
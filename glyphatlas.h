@@ -0,0 +1,81 @@
+#ifndef GLYPHATLAS_H
+#define GLYPHATLAS_H
+
+#include <QtCore/QHash>
+#include <QtCore/QRectF>
+#include <QtGui/QFont>
+#include <QtGui/QImage>
+
+class QGeometryData;
+class QGLTexture2D;
+class QMatrix4x4;
+
+/**
+ * \brief Characters of a font packed into one texture
+ *
+ * Glyphs are added on first use, in rows from the top left corner, each
+ * with some padding around it. How a glyph is drawn into the atlas is up
+ * to the user, see Rasterizer. Text is laid out in pixels like
+ * QPainterPath::addText, with one quad per character.
+ *
+ * The atlas is not grown when full. The user clears it and lays out the
+ * text again, so that it only holds the characters in use; layouts made
+ * before are recognized by generation().
+ */
+
+class GlyphAtlas {
+public:
+    /// Draw character @p c of @p font into @p rect of @p image, with the
+    /// pen (origin of the baseline) at @p pen in pixels of @p image.
+    typedef void (*Rasterizer)(QImage &image, const QRect &rect,
+            const QFont &font, QChar c, const QPointF &pen);
+
+    /// Create an empty atlas of @p size pixels square in @p format, for
+    /// glyphs of @p font with @p padding pixels on each side, drawn by
+    /// @p rasterize. The texture is shared through the resource manager
+    /// as @p key.
+    GlyphAtlas(const QString &key, const QFont &font, int size, int padding,
+            QImage::Format format, Rasterizer rasterize);
+    ~GlyphAtlas();
+
+    /// Remove all glyphs.
+    void clear();
+
+    /// Return a number changed whenever the atlas is cleared.
+    inline int generation() const { return clearCount; }
+
+    /// Append to @p geometry the quads of @p text with the pen starting at
+    /// @p pen, in pixels with y downwards, mapped by @p transform. Return
+    /// false if the atlas is full, leaving out the glyphs that do not fit.
+    bool appendText(QGeometryData &geometry, const QString &text, QPointF pen,
+            const QMatrix4x4 &transform);
+
+    /// Return the texture of the atlas, uploaded again if glyphs were added.
+    QGLTexture2D *texture();
+
+private:
+    Q_DISABLE_COPY(GlyphAtlas)
+
+    struct Glyph {
+        QRectF quad;    // relative to the pen position, in pixels
+        QRectF uv;
+        qreal advance;
+    };
+
+    const Glyph *glyph(QChar c);
+
+    QString key;
+    QFont font;
+    int padding;
+    Rasterizer rasterize;
+
+    QHash<QChar, Glyph> glyphs;
+    QImage image;
+    int cursorX, cursorY, rowHeight;
+    bool changed = true;
+    int clearCount = 0;
+
+    QGLTexture2D *tex = NULL;
+};
+
+#endif
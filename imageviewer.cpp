@@ -1,6 +1,9 @@
 #include "imageviewer.h"
 #include "common.h"
 #include "directory.h"
+#include "raypicker.h"
+#include "renderqueue.h"
+#include "resourcemanager.h"
 #include <Qt3D/QGLBuilder>
 #include <Qt3D/QGLPainter>
 
@@ -45,43 +48,37 @@ ImageViewer::ImageViewer(int w, int h)
 
 void ImageViewer::setFile(const QString &fileName)
 {
-    QGLTexture2D *tex = body->material()->texture();
-    if (tex) {
-        tex->release();
-        tex->deleteLater();
-    }
-    tex = new QGLTexture2D;
-    tex->setImage(QImage(fileName.isEmpty() ? defaultImage : fileName));
-    body->material()->setTexture(tex);
+    // acquire first, so that reloading the same file hits the cache
+    QGLTexture2D *prevTex = body->material()->texture();
+    body->material()->setTexture(
+            resources.acquireTexture(fileName.isEmpty() ? defaultImage : fileName));
+    resources.releaseTexture(prevTex);
 }
 
-void ImageViewer::draw(QGLPainter *painter)
+void ImageViewer::queue(RenderQueue *queue, QGLPainter *painter)
 {
     painter->modelViewMatrix().push();
     painter->modelViewMatrix() *= trans;
 
-    int prevPickId = painter->objectPickId();
-    painter->setObjectPickId(Image);
-
-    body->draw(painter);
+    queue->add(painter, body, Image);
 
-    if (painter->isPicking() || hoveringId >= Image) {
+    if (painter->isPicking() || hoveringId == Image || objectKind(hoveringId) == ButtonKind) {
         QColor color = painter->color();
         painter->setColor(QColor(Qt::white));
 
-        painter->setObjectPickId(ImagePrevBtn);
-        if (hoveringId == ImagePrevBtn)
-            hoveringPickColor = painter->pickColor();
-        prevBtn->draw(painter);
-
-        painter->setObjectPickId(ImageNextBtn);
-        if (hoveringId == ImageNextBtn)
-            hoveringPickColor = painter->pickColor();
-        nextBtn->draw(painter);
+        queue->add(painter, prevBtn, ImagePrevBtn);
+        queue->add(painter, nextBtn, ImageNextBtn);
 
         painter->setColor(color);
     }
 
-    painter->setObjectPickId(prevPickId);
     painter->modelViewMatrix().pop();
 }
+
+void ImageViewer::addToPicker(RayPicker *picker) const
+{
+    // buttons are always drawn in picking mode
+    picker->add(body, trans, Image);
+    picker->add(prevBtn, trans, ImagePrevBtn);
+    picker->add(nextBtn, trans, ImageNextBtn);
+}
@@ -6,6 +6,8 @@
 
 class QGLPainter;
 class QGLSceneNode;
+class RayPicker;
+class RenderQueue;
 
 /**
  * \brief Image previewer class
@@ -21,8 +23,11 @@ public:
     /// Create a ImageViewer of specific size.
     ImageViewer(int width, int height);
 
-    /// Update and draw the image.
-    void draw(QGLPainter *painter);
+    /// Queue the image, and the buttons if hovered.
+    void queue(RenderQueue *queue, QGLPainter *painter);
+
+    /// Add the image and the buttons to @p picker.
+    void addToPicker(RayPicker *picker) const;
 
     /// Load an image from file and display it.
     void setFile(const QString &fileName);
@@ -30,6 +35,7 @@ public:
     /// TODO: manage position in Room
     void setPosition(const QVector3D &pos)
     {
+        trans.setToIdentity();
         trans.translate(pos);
     }
 
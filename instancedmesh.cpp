@@ -0,0 +1,225 @@
+#include "instancedmesh.h"
+#include "common.h"
+#include "meshlod.h"
+#include "shadereffect.h"
+#include <Qt3D/QGLPainter>
+#include <Qt3D/QGLSceneNode>
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLFunctions>
+#include <QtGui/QOpenGLShaderProgram>
+
+#include <QtCore/QDebug>
+
+typedef void (QOPENGLF_APIENTRYP VertexAttribDivisorFunc)(GLuint, GLuint);
+typedef void (QOPENGLF_APIENTRYP DrawElementsInstancedFunc)(GLenum, GLsizei, GLenum, const void *, GLsizei);
+
+namespace {
+
+VertexAttribDivisorFunc vertexAttribDivisor = NULL;
+DrawElementsInstancedFunc drawElementsInstanced = NULL;
+
+/* Attribute locations after the standard ones of QGLPainter */
+const int MatrixLocation = QGL::UserVertex;     // 4 columns
+const int ColorLocation = QGL::UserVertex + 4;
+
+ShaderEffect *litEffect = NULL;
+ShaderEffect *pickEffect = NULL;
+
+void createEffects()
+{
+    litEffect = new ShaderEffect();
+    litEffect->setVertexShaderFromFile(":/shader/instanced.vsh");
+    litEffect->setFragmentShaderFromFile(":/shader/phong.fsh");
+    litEffect->bindAttributeLocation("instanceMatrix", MatrixLocation);
+
+    pickEffect = new ShaderEffect();
+    pickEffect->setVertexShaderFromFile(":/shader/instancedpick.vsh");
+    pickEffect->setFragmentShaderFromFile(":/shader/pick.fsh");
+    pickEffect->bindAttributeLocation("instanceMatrix", MatrixLocation);
+    pickEffect->bindAttributeLocation("instanceColor", ColorLocation);
+    pickEffect->setSupportsPicking(true);
+}
+
+}
+
+InstancedMesh::InstancedMesh(QGLSceneNode *mesh) :
+    levels(MeshLod::LevelCount + 1), box(mesh->boundingBox())
+{
+    levels[0] = collectParts(mesh);
+}
+
+InstancedMesh::~InstancedMesh()
+{
+    matrixBuffer.destroy();
+    colorBuffer.destroy();
+}
+
+bool InstancedMesh::isSupported()
+{
+    static int supported = -1;
+    if (supported != -1) return supported;
+
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    QSurfaceFormat format = context->format();
+
+    if (format.majorVersion() > 3 || (format.majorVersion() == 3 && format.minorVersion() >= 3)) {
+        vertexAttribDivisor = (VertexAttribDivisorFunc)context->getProcAddress("glVertexAttribDivisor");
+        drawElementsInstanced = (DrawElementsInstancedFunc)context->getProcAddress("glDrawElementsInstanced");
+    } else if (context->hasExtension("GL_ARB_instanced_arrays")
+            && context->hasExtension("GL_ARB_draw_instanced")) {
+        vertexAttribDivisor = (VertexAttribDivisorFunc)context->getProcAddress("glVertexAttribDivisorARB");
+        drawElementsInstanced = (DrawElementsInstancedFunc)context->getProcAddress("glDrawElementsInstancedARB");
+    }
+
+    supported = vertexAttribDivisor && drawElementsInstanced;
+    if (!supported)
+        qDebug() << "Instanced drawing not supported, entries are drawn one by one";
+    return supported;
+}
+
+void InstancedMesh::addInstance(const QMatrix4x4 &transform, int id)
+{
+    const float *data = transform.constData();
+    for (int i = 0; i < 16; ++i)
+        matrices.append(data[i]);
+    ids.append(id);
+    matricesDirty = true;
+}
+
+void InstancedMesh::draw(QGLPainter *painter, const QBitArray &visible, int level)
+{
+    if (ids.isEmpty() || levels[0].isEmpty()) return;
+
+    QList<MeshPart> &parts = levels[level];
+    if (parts.isEmpty()) {
+        parts = levels[0];
+        for (MeshPart &part : parts)
+            MeshLod::select(part, level);
+    }
+
+    if (!litEffect) createEffects();
+
+    // visible instances as (first, count) ranges
+    QList<QPair<int, int> > ranges;
+    int first = 0;
+    for (int i = 0; i <= ids.size(); ++i) {
+        if (i < ids.size() && (visible.isEmpty() || visible.testBit(i))) continue;
+        if (i > first) ranges.append(qMakePair(first, i - first));
+        first = i + 1;
+    }
+    if (ranges.isEmpty()) return;
+
+    if (matricesDirty) {
+        if (!matrixBuffer.isCreated()) matrixBuffer.create();
+        matrixBuffer.bind();
+        matrixBuffer.allocate(matrices.constData(), matrices.size() * sizeof(float));
+        matrixBuffer.release();
+        matricesDirty = false;
+    }
+
+    bool picking = painter->isPicking();
+    if (picking) uploadPickColors(painter);
+
+    QGLAbstractEffect *prevEffect = painter->userEffect();
+    QGL::StandardEffect prevStandardEffect = painter->standardEffect();
+
+    ShaderEffect *effect = picking ? pickEffect : litEffect;
+    painter->setUserEffect(effect);
+    if (!picking) {
+        // same as phong effect in View::paintGL
+        effect->program()->setUniformValue("ambientColor", 0.2f, 0.2f, 0.2f, 1.0f);
+        effect->program()->setUniformValue("diffuseColor", 1.0f, 1.0f, 1.0f, 1.0f);
+        effect->program()->setUniformValue("specularColor", 1.0f, 1.0f, 1.0f, 1.0f);
+    }
+
+    for (MeshPart &part : parts) {
+        if (!picking && part.material)
+            part.material->bind(painter);
+
+        part.geometry.upload();
+        painter->clearAttributes();
+        painter->setVertexBundle(part.geometry.vertexBundle());
+        painter->update();
+        effect->program()->setUniformValue("partMatrix", part.transform);
+
+        QGLIndexBuffer indices = part.geometry.indexBuffer();
+        GLenum type = indices.elementType();
+        qintptr offset = part.start * (type == GL_UNSIGNED_INT ? sizeof(GLuint) : sizeof(GLushort));
+
+        indices.bind();
+        for (const QPair<int, int> &range : ranges) {
+            bindInstances(range.first, picking);
+            drawElementsInstanced(part.mode, part.count, type,
+                    reinterpret_cast<const void *>(offset), range.second);
+        }
+        indices.release();
+        releaseInstances(picking);
+
+        if (!picking && part.material)
+            part.material->release(painter, NULL);
+    }
+
+    if (prevEffect)
+        painter->setUserEffect(prevEffect);
+    else
+        painter->setStandardEffect(prevStandardEffect);
+}
+
+void InstancedMesh::uploadPickColors(QGLPainter *painter)
+{
+    QVector<uchar> colors;
+    colors.reserve(ids.size() * 4);
+
+    int prevObjectId = painter->objectPickId();
+    for (int id : ids) {
+        painter->setObjectPickId(id);
+        QColor color = painter->pickColor();
+        if (hoveringId != -1 && hoveringId == id)
+            hoveringPickColor = color;
+        colors << color.red() << color.green() << color.blue() << color.alpha();
+    }
+    painter->setObjectPickId(prevObjectId);
+
+    if (!colorBuffer.isCreated()) colorBuffer.create();
+    colorBuffer.bind();
+    colorBuffer.allocate(colors.constData(), colors.size());
+    colorBuffer.release();
+}
+
+void InstancedMesh::bindInstances(int first, bool picking)
+{
+    QOpenGLFunctions *func = QOpenGLContext::currentContext()->functions();
+
+    matrixBuffer.bind();
+    for (int col = 0; col < 4; ++col) {
+        func->glEnableVertexAttribArray(MatrixLocation + col);
+        func->glVertexAttribPointer(MatrixLocation + col, 4, GL_FLOAT, GL_FALSE,
+                16 * sizeof(float),
+                reinterpret_cast<const void *>((first * 16 + col * 4) * sizeof(float)));
+        vertexAttribDivisor(MatrixLocation + col, 1);
+    }
+    matrixBuffer.release();
+
+    if (picking) {
+        colorBuffer.bind();
+        func->glEnableVertexAttribArray(ColorLocation);
+        func->glVertexAttribPointer(ColorLocation, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                4, reinterpret_cast<const void *>(first * 4));
+        vertexAttribDivisor(ColorLocation, 1);
+        colorBuffer.release();
+    }
+}
+
+void InstancedMesh::releaseInstances(bool picking)
+{
+    QOpenGLFunctions *func = QOpenGLContext::currentContext()->functions();
+
+    for (int col = 0; col < 4; ++col) {
+        vertexAttribDivisor(MatrixLocation + col, 0);
+        func->glDisableVertexAttribArray(MatrixLocation + col);
+    }
+    if (picking) {
+        vertexAttribDivisor(ColorLocation, 0);
+        func->glDisableVertexAttribArray(ColorLocation);
+    }
+}
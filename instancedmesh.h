@@ -0,0 +1,75 @@
+#ifndef INSTANCEDMESH_H
+#define INSTANCEDMESH_H
+
+#include "geometryutil.h"
+#include <Qt3D/QBox3D>
+#include <QtCore/QBitArray>
+#include <QtGui/QOpenGLBuffer>
+
+class QGLPainter;
+class QGLSceneNode;
+class ShaderEffect;
+
+/**
+ * \brief Copies of a mesh painted with one instanced draw call per part
+ *
+ * The mesh is flattened to parts (leaf nodes with geometry) when the object
+ * is created, so the mesh must be completely loaded. Each instance has its
+ * own transform and pick id, stored in vertex buffers with an attribute
+ * divisor of 1. Instances can be hidden at draw time, the remaining ones
+ * are drawn as contiguous ranges by offsetting the instance attributes.
+ *
+ * The instances are lit like the phong effect of View. In picking mode the
+ * pick color of each id is looked up from the painter every time, because
+ * the painter assigns pick colors per pass.
+ *
+ * Instanced drawing needs OpenGL 3.3 or GL_ARB_instanced_arrays and
+ * GL_ARB_draw_instanced, check isSupported() before using this class.
+ * Objects must be created, drawn and deleted with the context current.
+ */
+
+class InstancedMesh {
+public:
+    /// Prepare to draw copies of @p mesh.
+    InstancedMesh(QGLSceneNode *mesh);
+    ~InstancedMesh();
+
+    /// Return true if instanced drawing is available in current context.
+    static bool isSupported();
+
+    /// Add a copy of the mesh at @p transform, with pick id @p id.
+    void addInstance(const QMatrix4x4 &transform, int id);
+
+    /// Return the number of instances.
+    inline int count() const { return ids.size(); }
+
+    /// Return the transform of instance @p i.
+    inline QMatrix4x4 transform(int i) const { return QMatrix4x4(matrices.constData() + i * 16).transposed(); }
+
+    /// Return the pick id of instance @p i.
+    inline int id(int i) const { return ids.at(i); }
+
+    /// Return the bounding box of the mesh (of a single instance).
+    inline QBox3D bounds() const { return box; }
+
+    /// Draw the instances set in @p visible (indexed by instance, all of
+    /// them if empty), with the simplified geometry of @p level if there is
+    /// (see MeshLod).
+    void draw(QGLPainter *painter, const QBitArray &visible = QBitArray(), int level = 0);
+
+private:
+    void uploadPickColors(QGLPainter *painter);
+    void bindInstances(int first, bool picking);
+    void releaseInstances(bool picking);
+
+    // parts of each level of detail, built on first use
+    QVector<QList<MeshPart> > levels;
+    QBox3D box;
+
+    QVector<float> matrices;
+    QVector<int> ids;
+    QOpenGLBuffer matrixBuffer, colorBuffer;
+    bool matricesDirty = true;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "labelrenderer.h"
+#include "shadereffect.h"
+#include <Qt3D/QGLPainter>
+#include <Qt3D/QGLTexture2D>
+#include <QtCore/qmath.h>
+#include <QtGui/QFontMetricsF>
+#include <QtGui/QPainter>
+
+/* Side of the distance field atlas, room for a few hundred glyphs at GlyphSize */
+static const int AtlasSize = 1024;
+
+/* Pixel size of the font that distances are measured on */
+static const int GlyphSize = 48;
+
+/* Distance in pixels covered by the field on each side of the outline,
+ * also the space around glyphs */
+static const int Spread = 6;
+
+static QFont glyphFont(QFont font)
+{
+    font.setPixelSize(GlyphSize);
+    return font;
+}
+
+/* Distance to the outline in the alpha channel, 0.5 on it and greater
+ * inside, scaled so that Spread pixels cover a half */
+static void drawDistance(QImage &image, const QRect &rect, const QFont &font, QChar c,
+        const QPointF &pen)
+{
+    int width = rect.width(), height = rect.height();
+
+    // pixels inside the glyph, without antialiasing
+    QImage mask(width, height, QImage::Format_ARGB32_Premultiplied);
+    mask.fill(Qt::transparent);
+    QPainterPath path;
+    path.addText(pen - rect.topLeft(), font, QString(c));
+    QPainter painter(&mask);
+    painter.fillPath(path, QColor(Qt::white));
+    painter.end();
+
+    QVector<bool> inside(width * height);
+    for (int y = 0; y < height; ++y) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(mask.constScanLine(y));
+        for (int x = 0; x < width; ++x)
+            inside[y * width + x] = qAlpha(line[x]) > 127;
+    }
+
+    // distance to the nearest pixel on the other side of the outline,
+    // which lies half a pixel before it, searched up to Spread
+    for (int y = 0; y < height; ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(rect.y() + y)) + rect.x();
+        for (int x = 0; x < width; ++x) {
+            bool in = inside.at(y * width + x);
+            int nearest = Spread * Spread;
+            for (int dy = qMax(-Spread, -y); dy <= Spread && y + dy < height; ++dy)
+                for (int dx = qMax(-Spread, -x); dx <= Spread && x + dx < width; ++dx)
+                    if (inside.at((y + dy) * width + x + dx) != in)
+                        nearest = qMin(nearest, dx * dx + dy * dy);
+
+            qreal dist = qSqrt(nearest) - 0.5;
+            qreal value = 0.5 + (in ? dist : -dist) / (2 * Spread);
+            line[x] = qRgba(255, 255, 255, qBound(0, qRound(value * 255), 255));
+        }
+    }
+}
+
+LabelRenderer::LabelRenderer(const QFont &font) :
+    font(glyphFont(font)),
+    atlas("labels", this->font, AtlasSize, Spread, QImage::Format_ARGB32, drawDistance)
+{
+    effect = new ShaderEffect();
+    effect->setVertexShaderFromFile(":/shader/label.vsh");
+    effect->setFragmentShaderFromFile(":/shader/label.fsh");
+}
+
+LabelRenderer::~LabelRenderer()
+{
+    delete effect;
+}
+
+void LabelRenderer::build(LabelLayout &layout, const QStringList &texts,
+        const QVector<QMatrix4x4> &frames, qreal height, qreal maxWidth)
+{
+    if (!buildGeometry(layout, texts, frames, height, maxWidth)) {
+        // keep only the glyphs of this layout
+        atlas.clear();
+        buildGeometry(layout, texts, frames, height, maxWidth);
+    }
+    layout.generation = atlas.generation();
+}
+
+void LabelRenderer::draw(QGLPainter *painter, const LabelLayout &layout, int hidden)
+{
+    if (layout.starts.size() < 2 || layout.starts.last() == 0) return;
+
+    QGLTexture2D *texture = atlas.texture();
+
+    QGLAbstractEffect *prevEffect = painter->userEffect();
+    QGL::StandardEffect prevStandardEffect = painter->standardEffect();
+    QColor prevColor = painter->color();
+    painter->setUserEffect(effect);
+    painter->setColor(QColor(Qt::white));
+
+    glEnable(GL_BLEND);
+    glDepthMask(GL_FALSE);
+    texture->bind();
+
+    // the hidden label is left out by drawing the labels around it
+    QGeometryData geometry = layout.geometry;
+    int end = layout.starts.last();
+    if (hidden >= 0 && hidden + 1 < layout.starts.size()) {
+        int first = layout.starts.at(hidden), last = layout.starts.at(hidden + 1);
+        if (first > 0) geometry.draw(painter, 0, first);
+        if (last < end) geometry.draw(painter, last, end - last);
+    } else
+        geometry.draw(painter, 0, end);
+
+    QGLTexture2D::release();
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+
+    painter->setColor(prevColor);
+    if (prevEffect)
+        painter->setUserEffect(prevEffect);
+    else
+        painter->setStandardEffect(prevStandardEffect);
+}
+
+/* Return false if the atlas is full, leaving out the glyphs that
+ * do not fit */
+bool LabelRenderer::buildGeometry(LabelLayout &layout, const QStringList &texts,
+        const QVector<QMatrix4x4> &frames, qreal height, qreal maxWidth)
+{
+    QFontMetricsF metrics(font);
+    qreal scale = height / GlyphSize;
+    bool complete = true;
+
+    QGeometryData geometry;
+    layout.starts.clear();
+
+    for (int i = 0; i < texts.size() && i < frames.size(); ++i) {
+        layout.starts << geometry.indexCount();
+        QString text = metrics.elidedText(texts.at(i), Qt::ElideMiddle, maxWidth / scale);
+
+        // centered on the origin, laid out in pixels with y downwards,
+        // to units of the frame with y upwards
+        QPointF pen(-metrics.width(text) / 2, (metrics.ascent() - metrics.descent()) / 2);
+        QMatrix4x4 transform = frames.at(i);
+        transform.scale(scale, -scale, 1);
+        complete &= atlas.appendText(geometry, text, pen, transform);
+    }
+    layout.starts << geometry.indexCount();
+
+    layout.geometry = geometry;
+    return complete;
+}
@@ -0,0 +1,65 @@
+#ifndef LABELRENDERER_H
+#define LABELRENDERER_H
+
+#include "glyphatlas.h"
+#include <Qt3D/QGeometryData>
+#include <QtCore/QStringList>
+#include <QtGui/QMatrix4x4>
+
+class QGLPainter;
+class ShaderEffect;
+
+/// Quads of a set of labels, drawn by LabelRenderer.
+struct LabelLayout {
+    QGeometryData geometry;
+    QVector<int> starts;    // first index of each label, and the end
+    int generation = -1;    // of the atlas, see LabelRenderer::generation()
+};
+
+/**
+ * \brief Labels in the scene drawn from a signed distance field atlas
+ *
+ * Each character is rasterized once at a large size and stored in an atlas
+ * as its distance to the outline, positive inside. Magnified or minified,
+ * the interpolated distance still finds the outline within a pixel, so the
+ * shader draws sharp letters with a dark border at any distance.
+ *
+ * Labels are laid out into a LabelLayout kept by the caller, with vertices
+ * already transformed by the frame of each label, so all labels of a layout
+ * are drawn with a single call.
+ *
+ * When the atlas is full, it is cleared and filled with the characters of
+ * the layout being built. Layouts of an older generation() must be built
+ * again before they are drawn.
+ */
+
+class LabelRenderer {
+public:
+    /// Create a renderer of labels in the family and weight of @p font.
+    LabelRenderer(const QFont &font);
+    ~LabelRenderer();
+
+    /// Lay out @p texts into @p layout, text @p i centered at the origin of
+    /// @p frames[i] in its xy plane, with letters @p height high. Texts
+    /// wider than @p maxWidth are elided in the middle. Both are in units
+    /// of the frames.
+    void build(LabelLayout &layout, const QStringList &texts,
+            const QVector<QMatrix4x4> &frames, qreal height, qreal maxWidth);
+
+    /// Return a number changed whenever the atlas is cleared.
+    inline int generation() const { return atlas.generation(); }
+
+    /// Draw all labels of @p layout except label @p hidden with @p painter,
+    /// blended over the scene without writing depth.
+    void draw(QGLPainter *painter, const LabelLayout &layout, int hidden = -1);
+
+private:
+    bool buildGeometry(LabelLayout &layout, const QStringList &texts,
+            const QVector<QMatrix4x4> &frames, qreal height, qreal maxWidth);
+
+    QFont font;
+    GlyphAtlas atlas;
+    ShaderEffect *effect;
+};
+
+#endif
@@ -48,7 +48,9 @@
 #include "qgltexture2d.h"
 
 #include <QOpenGLFramebufferObject>
+#include <QOpenGLBuffer>
 #include <QEvent>
+#include <QHash>
 #include <QMap>
 #include <QGuiApplication>
 #include <QTimer>
@@ -56,11 +58,24 @@
 #include <QDebug>
 #include <QResizeEvent>
 #include <QExposeEvent>
+#include <QElapsedTimer>
 #include <QOpenGLContext>
 #include <QSurfaceFormat>
 
 QT_BEGIN_NAMESPACE
 
+// GL_ARB_sync, missing from older headers
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+typedef struct __GLsync *GLsync;
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define GL_ALREADY_SIGNALED 0x911A
+#define GL_CONDITION_SATISFIED 0x911C
+#endif
+
+typedef GLsync (QOPENGLF_APIENTRYP FenceSyncFunc)(GLenum, GLbitfield);
+typedef GLenum (QOPENGLF_APIENTRYP ClientWaitSyncFunc)(GLsync, GLbitfield, GLuint64);
+typedef void (QOPENGLF_APIENTRYP DeleteSyncFunc)(GLsync);
+
 /*!
     \class GLView
     \brief The GLView class extends QGLWidget with support for 3D viewing.
@@ -234,6 +249,13 @@ public:
 
         pickBufferForceUpdate = true;
         pickBufferMaybeInvalid = true;
+        nextReadback = 0;
+        hasPixelBuffer = -1;
+        fenceSync = 0;
+        clientWaitSync = 0;
+        deleteSync = 0;
+        frameCount = 0;
+        paintNsecs = 0;
         updateQueued = false;
 
         pressedObject = 0;
@@ -254,6 +276,7 @@ public:
 
         logTime.start();
         lastFrameTime.start();
+        frameClock.start();
         QByteArray env = qgetenv("QT3D_LOG_EVENTS");
         if (env == "1")
             options |= GLView::PaintingLog;
@@ -280,6 +303,38 @@ public:
     bool pickBufferForceUpdate;
     bool pickBufferMaybeInvalid;
     bool updateQueued;
+
+    // pick colors assigned in the last pick pass
+    QList<QPair<int, int> > objectIdRanges;
+    QHash<QRgb, int> pickObjects;
+    QHash<int, QRgb> pickColors;
+
+    // object ids read from the pick buffer without waiting for the GPU;
+    // a read is only mapped once its fence has signalled, or without
+    // fences ReadbackLatency frames after it was issued
+    struct Readback {
+        QOpenGLBuffer buffer;
+        QPoint point;
+        QHash<QRgb, int> pickObjects;
+        int objectId;
+        GLsync fence;
+        qint64 frame;
+        bool issued;
+        bool pending;
+        Readback() : buffer(QOpenGLBuffer::PixelPackBuffer),
+            fence(0), frame(0), issued(false), pending(false) {}
+    };
+    enum { ReadbackCount = 3, ReadbackLatency = 2 };
+    Readback readbacks[ReadbackCount];
+    int nextReadback;
+    int hasPixelBuffer;
+    FenceSyncFunc fenceSync;
+    ClientWaitSyncFunc clientWaitSync;
+    DeleteSyncFunc deleteSync;
+    qint64 frameCount;
+
+    bool isReadbackDone(Readback &read);
+    void finishReadback(Readback &read);
     QMap<int, QObject *> objects;
     QObject *pressedObject;
     Qt::MouseButton pressedButton;
@@ -296,6 +351,8 @@ public:
     QTime logTime;
     QTime enterTime;
     QTime lastFrameTime;
+    QElapsedTimer frameClock;
+    qint64 paintNsecs;
 
     inline void logEnter(const char *message);
     inline void logLeave(const char *message);
@@ -836,14 +893,45 @@ void GLView::exposeEvent(QExposeEvent *e)
 {
     Q_UNUSED(e);
 
-    d->updateQueued = false;
+    // nothing to paint while hidden or occluded
+    if (!isExposed())
+        return;
+
+    renderFrame();
+}
+
+/*!
+    Handles update requests posted by update(), painting a frame
+    unless the window is not exposed, then passes other events
+    \a e to QWindow.
+*/
+bool GLView::event(QEvent *e)
+{
+    if (e->type() == QEvent::UpdateRequest) {
+        d->updateQueued = false;
+        // dropped while hidden, the next expose event paints
+        if (isExposed())
+            renderFrame();
+        return true;
+    }
+    return QWindow::event(e);
+}
+
+void GLView::renderFrame()
+{
     d->ensureContext();
     if (!d->initialized)
         initializeGL();
 
-    paintGL();
+    collectObjectIds();
+    prepareFrame(d->frameClock.elapsed());
 
+    QElapsedTimer timer;
+    timer.start();
+    paintGL();
     d->context->swapBuffers(this);
+    d->paintNsecs = timer.nsecsElapsed();
+    ++d->frameCount;
 }
 
 void GLView::resizeEvent(QResizeEvent *e)
@@ -971,15 +1059,31 @@ void GLView::paintGL()
     d->logLeave("GLView::paintGL");
 }
 
+/*!
+    Schedules a frame.  Requests are coalesced until the frame is
+    painted, and paced by the display refresh with a swap interval of 1.
+*/
 void GLView::update()
 {
     if (!d->updateQueued)
     {
         d->updateQueued = true;
-        QGuiApplication::postEvent(this, new QExposeEvent(geometry()));
+        requestUpdate();
     }
 }
 
+/*!
+    Called before each frame is painted with the \a msecs elapsed since
+    the view was created, to advance animations by the frame clock.
+    Calling update() from here schedules the next frame.
+
+    The default implementation does nothing.
+*/
+void GLView::prepareFrame(qint64 msecs)
+{
+    Q_UNUSED(msecs);
+}
+
 /*!
     Initializes the current GL context represented by \a painter.
 
@@ -1374,51 +1478,259 @@ int GLView::objectIdForPoint(const QPoint &point)
             pt.y() < 0 || pt.y() >= areaSize.height())
         return 0;
 
-    // Do we need to refresh the pick buffer contents?
+    // Initialize the painter, which will make the window context current,
+    // and refresh the pick buffer contents if needed.
     QGLPainter painter(this);
-    if (d->pickBufferForceUpdate) {
-        // Initialize the painter, which will make the window context current.
-        painter.setPicking(true);
-        painter.clearPickObjects();
+    QOpenGLFramebufferObject *fbo = pickBuffer(&painter);
+
+    // Pick the object under the mouse.
+    fbo->bind();
+    int objectId = painter.pickObject(pt.x(), areaSize.height() - 1 - pt.y());
+    fbo->release();
+
+    // Release the framebuffer object and return.
+    painter.end();
+    return objectId;
+}
+
+/*!
+    Reads the object identifier under \a point like objectIdForPoint(),
+    without waiting for the GPU.  The result is passed to objectIdReady()
+    at the start of a later frame, once the read has completed.  If several
+    requests complete by then, only the last one is reported.
+
+    Pixels are read into a ring of pixel pack buffers, each mapped only
+    when its fence has signalled (GL 3.2 or GL_ARB_sync), or otherwise
+    two frames after the read.  Without pixel buffer support, pixels are
+    read immediately and reported at the start of the next frame.
+*/
+void GLView::requestObjectId(const QPoint &point)
+{
+    GLViewPrivate::Readback &read = d->readbacks[d->nextReadback];
+    d->nextReadback = (d->nextReadback + 1) % GLViewPrivate::ReadbackCount;
+    d->finishReadback(read);
+    read.point = point;
+    read.objectId = -1;
+    read.frame = d->frameCount;
+    read.pending = true;
+
+    // collected when a later frame starts
+    update();
+
+    const QSize areaSize = size();
+    if (point.x() < 0 || point.x() >= areaSize.width() ||
+            point.y() < 0 || point.y() >= areaSize.height())
+        return;
+
+    QGLPainter painter(this);
+    QOpenGLFramebufferObject *fbo = pickBuffer(&painter);
+
+    if (d->hasPixelBuffer == -1) {
+        QSurfaceFormat format = d->context->format();
+        d->hasPixelBuffer = format.majorVersion() > 2
+            || (format.majorVersion() == 2 && format.minorVersion() >= 1)
+            || d->context->hasExtension("GL_ARB_pixel_buffer_object");
+
+        if (format.majorVersion() > 3
+                || (format.majorVersion() == 3 && format.minorVersion() >= 2)
+                || d->context->hasExtension("GL_ARB_sync")) {
+            d->fenceSync = (FenceSyncFunc)d->context->getProcAddress("glFenceSync");
+            d->clientWaitSync = (ClientWaitSyncFunc)d->context->getProcAddress("glClientWaitSync");
+            d->deleteSync = (DeleteSyncFunc)d->context->getProcAddress("glDeleteSync");
+            if (!d->fenceSync || !d->clientWaitSync || !d->deleteSync)
+                d->fenceSync = 0;
+        }
+    }
+
+    fbo->bind();
+    if (d->hasPixelBuffer) {
+        if (!read.buffer.isCreated()) {
+            read.buffer.create();
+            read.buffer.bind();
+            read.buffer.allocate(4);
+        } else {
+            read.buffer.bind();
+        }
+        // queued, the copy happens when the GPU gets there
+        glReadPixels(point.x(), areaSize.height() - 1 - point.y(), 1, 1,
+                     GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        read.buffer.release();
+        if (d->fenceSync)
+            read.fence = d->fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        read.pickObjects = d->pickObjects;
+        read.issued = true;
+        glFlush();
+    } else {
+        read.objectId = painter.pickObject(point.x(), areaSize.height() - 1 - point.y());
+    }
+    fbo->release();
+
+    painter.end();
+}
+
+/* Return true if mapping the buffer of read would not wait for the GPU */
+bool GLViewPrivate::isReadbackDone(Readback &read)
+{
+    if (!read.issued)
+        return true;
+    if (read.fence) {
+        GLenum result = clientWaitSync(read.fence, 0, 0);
+        return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+    }
+    return frameCount - read.frame >= ReadbackLatency;
+}
 
-        // Create a framebuffer object as big as the window to act
-        // as the pick buffer if we are single buffered.  If we are
-        // double-buffered, then use the window back buffer.
-        QSize fbosize = QGL::nextPowerOfTwo(areaSize);
-        if (!d->fbo) {
-            d->fbo = new QOpenGLFramebufferObject(fbosize, QOpenGLFramebufferObject::CombinedDepthStencil);
-        } else if (d->fbo->size() != fbosize) {
-            delete d->fbo;
-            d->fbo = new QOpenGLFramebufferObject(fbosize, QOpenGLFramebufferObject::CombinedDepthStencil);
+void GLViewPrivate::finishReadback(Readback &read)
+{
+    if (read.fence) {
+        deleteSync(read.fence);
+        read.fence = 0;
+    }
+    read.pickObjects.clear();
+    read.issued = false;
+    read.pending = false;
+}
+
+/* Report the newest completed request; older ones are outdated and
+ * dropped, newer ones still in flight are left for a later frame */
+void GLView::collectObjectIds()
+{
+    GLViewPrivate::Readback *latest = 0;
+    bool inFlight = false;
+    bool current = false;
+
+    // from the newest request to the oldest
+    for (int i = GLViewPrivate::ReadbackCount - 1; i >= 0; --i) {
+        GLViewPrivate::Readback &read =
+            d->readbacks[(d->nextReadback + i) % GLViewPrivate::ReadbackCount];
+        if (!read.pending)
+            continue;
+
+        if (!current) {
+            d->context->makeCurrent(this);
+            current = true;
         }
+        if (latest)
+            d->finishReadback(read);
+        else if (d->isReadbackDone(read))
+            latest = &read;
+        else
+            inFlight = true;
+    }
+
+    if (inFlight)
+        update();
+    if (!latest)
+        return;
+
+    if (latest->issued && !latest->pickObjects.isEmpty()) {
+        latest->buffer.bind();
+        const uchar *data = static_cast<const uchar *>
+            (latest->buffer.map(QOpenGLBuffer::ReadOnly));
+        if (data) {
+            latest->objectId = latest->pickObjects.value(qRgb(data[0], data[1], data[2]), -1);
+            latest->buffer.unmap();
+        }
+        latest->buffer.release();
+    }
+    d->finishReadback(*latest);
+
+    objectIdReady(latest->point, latest->objectId);
+}
+
+/*!
+    Called with the \a objectId under \a point requested by
+    requestObjectId().  The default implementation does nothing.
+*/
+void GLView::objectIdReady(const QPoint &point, int objectId)
+{
+    Q_UNUSED(point);
+    Q_UNUSED(objectId);
+}
+
+/*!
+    Returns the pick buffer, a framebuffer as big as the view holding
+    the scene painted with pick colors.  It is painted again with
+    \a painter if the camera, the size or the scene changed since.
+
+    Pick colors of identifiers up to the maximum object id are kept
+    to decode pixels read from it, see pickColorForObject().
+*/
+QOpenGLFramebufferObject *GLView::pickBuffer(QGLPainter *painter)
+{
+    const QSize areaSize = size();
+    if (!d->fbo || d->fbo->size() != areaSize) {
+        delete d->fbo;
+        d->fbo = new QOpenGLFramebufferObject(areaSize, QOpenGLFramebufferObject::CombinedDepthStencil);
+        d->pickBufferForceUpdate = true;
+    }
+
+    if (d->pickBufferForceUpdate) {
+        bool picking = painter->isPicking();
+        painter->setPicking(true);
+        painter->clearPickObjects();
 
         // Render the pick version of the scene.
         GLViewPickSurface surface(this, d->fbo, areaSize);
-        painter.pushSurface(&surface);
+        painter->pushSurface(&surface);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        painter.setEye(QGL::NoEye);
-        painter.setCamera(d->camera);
-        paintGL(&painter);
-        painter.setPicking(false);
-        painter.popSurface();
+        painter->setEye(QGL::NoEye);
+        painter->setCamera(d->camera);
+        paintGL(painter);
+        painter->popSurface();
+
+        // Colors are assigned on first use, those not used get new ones.
+        int prevObjectId = painter->objectPickId();
+        d->pickObjects.clear();
+        d->pickColors.clear();
+        for (const QPair<int, int> &range : d->objectIdRanges) {
+            for (int id = range.first; id <= range.second; ++id) {
+                painter->setObjectPickId(id);
+                QRgb color = painter->pickColor().rgb();
+                d->pickObjects.insert(color, id);
+                d->pickColors.insert(id, color);
+            }
+        }
+        painter->setObjectPickId(prevObjectId);
+        painter->setPicking(picking);
 
-        // The pick buffer contents are now valid, unless we are using
-        // the back buffer - we cannot rely upon it being valid next time.
         d->pickBufferForceUpdate = false;
         d->pickBufferMaybeInvalid = false;
     }
 
-    // Pick the object under the mouse.
-    if (d->fbo)
-        d->fbo->bind();
-    int objectId = painter.pickObject(pt.x(), areaSize.height() - 1 - pt.y());
-    //QObject *object = d->objects.value(objectId, 0);
-    if (d->fbo)
-        d->fbo->release();
+    return d->fbo;
+}
 
-    // Release the framebuffer object and return.
-    painter.end();
-    return objectId;
+/*!
+    Marks the pick buffer as invalid, so that it is painted again
+    when next used.  Call this when the scene changed.
+*/
+void GLView::invalidatePickBuffer()
+{
+    d->pickBufferForceUpdate = true;
+}
+
+/*!
+    Sets the object identifiers that may be used in the scene to
+    \a ranges of first and last identifiers, for pickColorForObject()
+    and requestObjectId().  Identifiers may be sparse, as pick colors
+    are assigned in order of use rather than by value.  This may be
+    called from paintGL() in picking mode, before the objects are drawn.
+*/
+void GLView::setObjectIdRanges(const QList<QPair<int, int> > &ranges)
+{
+    d->objectIdRanges = ranges;
+}
+
+/*!
+    Returns the color of \a objectId in the pick buffer, or an invalid
+    color if it is out of the object identifier ranges.
+*/
+QColor GLView::pickColorForObject(int objectId) const
+{
+    if (!d->pickColors.contains(objectId))
+        return QColor();
+    return QColor(d->pickColors.value(objectId));
 }
 
 void GLView::sendEnterEvent(QObject *object)
@@ -1586,4 +1898,14 @@ bool GLView::isVisible() const
     return d->visible;
 }
 
+/*!
+    Returns the time in nanoseconds that painting the last frame took,
+    from the start of paintGL() to the return of the buffer swap.  With
+    vsync on, this includes waiting for the display.
+*/
+qint64 GLView::paintTime() const
+{
+    return d->paintNsecs;
+}
+
 QT_END_NAMESPACE
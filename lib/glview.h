@@ -50,6 +50,7 @@
 QT_BEGIN_NAMESPACE
 
 class GLViewPrivate;
+class QOpenGLFramebufferObject;
 
 class GLView : public QWindow
 {
@@ -95,6 +96,7 @@ public:
     QObject *objectForPoint(const QPoint &point);
 
     int objectIdForPoint(const QPoint &point);
+    void requestObjectId(const QPoint &point);
     
     QGLCamera *camera() const;
     void setCamera(QGLCamera *camera);
@@ -102,6 +104,7 @@ public:
     QVector3D mapPoint(const QPoint &point) const;
     QOpenGLContext *context();
     bool isVisible() const;
+    qint64 paintTime() const;
 
 Q_SIGNALS:
     void quit();
@@ -115,8 +118,15 @@ protected:
     void paintGL();
 
     virtual void initializeGL(QGLPainter *painter);
+    virtual void prepareFrame(qint64 msecs);
     virtual void earlyPaintGL(QGLPainter *painter);
     virtual void paintGL(QGLPainter *painter);
+    virtual void objectIdReady(const QPoint &point, int objectId);
+
+    QOpenGLFramebufferObject *pickBuffer(QGLPainter *painter);
+    void invalidatePickBuffer();
+    void setObjectIdRanges(const QList<QPair<int, int> > &ranges);
+    QColor pickColorForObject(int objectId) const;
 
     void mousePressEvent(QMouseEvent *e);
     void mouseReleaseEvent(QMouseEvent *e);
@@ -127,6 +137,7 @@ protected:
 #endif
     void keyPressEvent(QKeyEvent *e);
 
+    bool event(QEvent *e);
     void showEvent(QShowEvent *e);
     void hideEvent(QHideEvent *e);
     void exposeEvent(QExposeEvent *e);
@@ -145,6 +156,8 @@ private:
     static void sendEnterEvent(QObject *object);
     static void sendLeaveEvent(QObject *object);
 
+    void renderFrame();
+    void collectObjectIds();
     void wheel(int delta);
     void pan(int deltax, int deltay);
     void rotate(int deltax, int deltay);
@@ -1,19 +1,36 @@
 #include "common.h"
+#include "assetloader.h"
+#include "trace.h"
 #include "view.h"
 #include <QtWidgets/QApplication>
 #include <Qt3D/QGLTexture2D>
 
-void loadConfig(const QString &fileName);
+#include <QtCore/QDebug>
+
+void loadConfig(const QString &fileName, AssetLoader *loader);
+QGLTexture2D *installTexture(const QString &fileName, const QImage &image);
+void installModel(const QString &fileName, QGLAbstractScene *scene);
 
 int windowWidth, windowHeight;
 
 int hoveringId = -1;
 QColor hoveringPickColor;
 
+QElapsedTimer startupTimer;
+
 int main(int argc, char *argv[]) {
+    startupTimer.start();
+
     QApplication app(argc, argv);
+    Trace::init(app.arguments());
+    QObject::connect(&app, &QApplication::aboutToQuit, &Trace::write);
 
-    loadConfig("main.conf");
+    // only parse config here, textures and models are loaded in background
+    AssetLoader *loader = new AssetLoader;
+    loadConfig("main.conf", loader);
+
+    // measure frame time once everything is loaded, see View::startBenchmark
+    bool bench = app.arguments().contains("--bench");
 
     QSurfaceFormat format;
     format.setMajorVersion(2);
@@ -25,10 +42,46 @@ int main(int argc, char *argv[]) {
     format.setAlphaBufferSize(8);
     format.setStencilBufferSize(8);
     format.setSwapBehavior(QSurfaceFormat::DoubleBuffer);
+    // frames are paced by the display refresh, except when measured
+    format.setSwapInterval(bench ? 0 : 1);
     format.setSamples(4);
 
     View *view = new View(800, 600, format);
+
+    QObject::connect(loader, &AssetLoader::textureLoaded, view,
+            [=](const QString &fileName, const QImage &image)
+            {
+                QGLTexture2D *tex = installTexture(fileName, image);
+
+                // upload now so that the cost shows up in the trace
+                if (tex && Trace::isEnabled() && view->context()) {
+                    view->context()->makeCurrent(view);
+                    TraceSpan span("upload " + fileName);
+                    tex->bind();
+                    tex->release();
+                }
+                view->invalidate(View::RoomDirty | View::ImageDirty);
+            });
+
+    QObject::connect(loader, &AssetLoader::modelLoaded, view,
+            [=](const QString &fileName, QGLAbstractScene *scene)
+            {
+                installModel(fileName, scene);
+                view->invalidate(View::RoomDirty);
+            });
+
+    QObject::connect(loader, &AssetLoader::finished, view,
+            [=]()
+            {
+                qDebug() << "Fully loaded in" << startupTimer.elapsed() << "ms";
+                Trace::instant("fully loaded");
+                Trace::write();
+                loader->deleteLater();
+                if (bench) view->startBenchmark();
+            });
+
     view->show();
+    loader->start();
 
     return app.exec();
 }
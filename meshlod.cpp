@@ -0,0 +1,332 @@
+#include "meshlod.h"
+#include "geometryutil.h"
+#include <Qt3D/QGLSceneNode>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <map>
+#include <queue>
+#include <tuple>
+
+namespace {
+
+/* Triangle ratios of levels 1 ~ LevelCount */
+const qreal LevelRatio[MeshLod::LevelCount] = { 0.5, 0.1, 0.02 };
+
+/* Smaller parts are not worth simplifying */
+const int MinTriangles = 64;
+
+/* Projected size in pixels below which each level is used */
+const qreal LevelSize[MeshLod::LevelCount] = { 256, 96, 32 };
+
+QMutex mutex;
+QHash<const QGLSceneNode*, QVector<QGeometryData> > levels;
+
+/* Symmetric 4x4 matrix of the quadric error metric */
+struct Quadric {
+    double m[10];
+
+    Quadric() { for (double &v : m) v = 0; }
+
+    Quadric(double a, double b, double c, double d)
+    {
+        m[0] = a * a; m[1] = a * b; m[2] = a * c; m[3] = a * d;
+        m[4] = b * b; m[5] = b * c; m[6] = b * d;
+        m[7] = c * c; m[8] = c * d;
+        m[9] = d * d;
+    }
+
+    Quadric &operator+=(const Quadric &q)
+    {
+        for (int i = 0; i < 10; ++i) m[i] += q.m[i];
+        return *this;
+    }
+
+    double error(const QVector3D &v) const
+    {
+        double x = v.x(), y = v.y(), z = v.z();
+        return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+             + m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+             + m[7] * z * z + 2 * m[8] * z
+             + m[9];
+    }
+};
+
+struct Collapse {
+    double cost;
+    int keep, remove;
+    int keepStamp, removeStamp;
+    bool operator<(const Collapse &other) const { return cost > other.cost; }
+};
+
+class Simplifier {
+public:
+    Simplifier(const QGeometryData &geometry, int start, int count);
+    // collapse edges until @p targetTriangles remain, return the result;
+    // may be called again with a smaller target
+    QGeometryData simplify(int targetTriangles);
+
+private:
+    int find(int v);
+    void pushEdge(int a, int b);
+    bool flips(int remove, int keep);
+    void collapse(int keep, int remove);
+    int closestVertex(int v, int welded) const;
+
+    const QGeometryData &geometry;
+    QVector<int> corners;           // 3 per triangle, welded vertices
+    QVector<int> original;          // 3 per triangle, vertices of the input
+    QVector<QVector<int> > sharing; // input vertices of each welded vertex
+    QVector<bool> dead;
+    int liveTriangles = 0;
+
+    QVector<int> parent, stamp;
+    QVector<Quadric> quadrics;
+    QVector<QVector<int> > vertexTriangles;
+    std::priority_queue<Collapse> heap;
+};
+
+Simplifier::Simplifier(const QGeometryData &geometry, int start, int count) :
+    geometry(geometry)
+{
+    int vertexCount = geometry.count();
+    parent.resize(vertexCount);
+    stamp.fill(0, vertexCount);
+    quadrics.resize(vertexCount);
+    vertexTriangles.resize(vertexCount);
+    sharing.resize(vertexCount);
+
+    // weld vertices of the same position for the topology,
+    // the corners keep the attributes of their own vertex
+    std::map<std::tuple<float, float, float>, int> welded;
+    for (int v = 0; v < vertexCount; ++v) {
+        QVector3D p = geometry.vertexAt(v);
+        auto key = std::make_tuple(float(p.x()), float(p.y()), float(p.z()));
+        auto it = welded.find(key);
+        parent[v] = it == welded.end() ? (welded[key] = v) : it->second;
+        sharing[parent[v]] << v;
+    }
+
+    QGL::IndexArray indices = geometry.indices();
+    for (int i = start; i + 2 < start + count; i += 3) {
+        int a = parent[indices.at(i)], b = parent[indices.at(i + 1)], c = parent[indices.at(i + 2)];
+        if (a == b || b == c || c == a) continue;
+
+        int t = corners.size() / 3;
+        corners << a << b << c;
+        original << indices.at(i) << indices.at(i + 1) << indices.at(i + 2);
+        vertexTriangles[a] << t;
+        vertexTriangles[b] << t;
+        vertexTriangles[c] << t;
+
+        QVector3D pa = geometry.vertexAt(a);
+        QVector3D n = QVector3D::crossProduct(geometry.vertexAt(b) - pa, geometry.vertexAt(c) - pa);
+        // weighted by area, so that slivers matter less
+        qreal area = n.length();
+        if (area > 0) n /= area;
+        Quadric q(n.x(), n.y(), n.z(), -QVector3D::dotProduct(n, pa));
+        for (double &v : q.m) v *= area;
+        quadrics[a] += q;
+        quadrics[b] += q;
+        quadrics[c] += q;
+    }
+
+    dead.fill(false, corners.size() / 3);
+    liveTriangles = dead.size();
+
+    for (int i = 0; i < corners.size(); i += 3) {
+        pushEdge(corners[i], corners[i + 1]);
+        pushEdge(corners[i + 1], corners[i + 2]);
+        pushEdge(corners[i + 2], corners[i]);
+    }
+}
+
+int Simplifier::find(int v)
+{
+    while (parent[v] != v)
+        v = parent[v] = parent[parent[v]];
+    return v;
+}
+
+void Simplifier::pushEdge(int a, int b)
+{
+    Quadric q = quadrics[a];
+    q += quadrics[b];
+    double costA = q.error(geometry.vertexAt(a));
+    double costB = q.error(geometry.vertexAt(b));
+
+    if (costA <= costB)
+        heap.push(Collapse{costA, a, b, stamp[a], stamp[b]});
+    else
+        heap.push(Collapse{costB, b, a, stamp[b], stamp[a]});
+}
+
+/* Return true if moving remove to keep turns any triangle over */
+bool Simplifier::flips(int remove, int keep)
+{
+    QVector3D to = geometry.vertexAt(keep);
+
+    for (int t : vertexTriangles[remove]) {
+        if (dead[t]) continue;
+        int *c = &corners[t * 3];
+        if (c[0] == keep || c[1] == keep || c[2] == keep) continue;
+
+        QVector3D p[3], q[3];
+        for (int i = 0; i < 3; ++i) {
+            p[i] = geometry.vertexAt(c[i]);
+            q[i] = c[i] == remove ? to : p[i];
+        }
+        QVector3D before = QVector3D::crossProduct(p[1] - p[0], p[2] - p[0]);
+        QVector3D after = QVector3D::crossProduct(q[1] - q[0], q[2] - q[0]);
+        if (QVector3D::dotProduct(before, after) <= 0) return true;
+    }
+    return false;
+}
+
+void Simplifier::collapse(int keep, int remove)
+{
+    parent[remove] = keep;
+    quadrics[keep] += quadrics[remove];
+    ++stamp[keep];
+    ++stamp[remove];
+
+    QVector<int> neighbours;
+    for (int t : vertexTriangles[remove]) {
+        if (dead[t]) continue;
+        int *c = &corners[t * 3];
+        for (int i = 0; i < 3; ++i) {
+            if (c[i] != remove) continue;
+            c[i] = keep;
+            original[t * 3 + i] = closestVertex(original[t * 3 + i], keep);
+        }
+
+        if (c[0] == c[1] || c[1] == c[2] || c[2] == c[0]) {
+            dead[t] = true;
+            --liveTriangles;
+        } else {
+            vertexTriangles[keep] << t;
+        }
+    }
+    vertexTriangles[remove].clear();
+
+    for (int t : vertexTriangles[keep]) {
+        if (dead[t]) continue;
+        for (int i = 0; i < 3; ++i) {
+            int v = corners[t * 3 + i];
+            if (v != keep && !neighbours.contains(v)) neighbours << v;
+        }
+    }
+    for (int v : neighbours)
+        pushEdge(keep, v);
+}
+
+/* Return the input vertex at the position of @p welded whose normal and
+ * texture coordinates are closest to those of input vertex @p v, so that
+ * a corner moved across a seam stays on its side */
+int Simplifier::closestVertex(int v, int welded) const
+{
+    bool hasNormal = geometry.hasField(QGL::Normal);
+    bool hasTexCoord = geometry.hasField(QGL::TextureCoord0);
+
+    int best = welded;
+    qreal bestDiff = -1;
+    for (int w : sharing[welded]) {
+        qreal diff = 0;
+        if (hasNormal)
+            diff += 1 - QVector3D::dotProduct(geometry.normalAt(v), geometry.normalAt(w));
+        if (hasTexCoord)
+            diff += (geometry.texCoordAt(v) - geometry.texCoordAt(w)).length();
+        if (bestDiff < 0 || diff < bestDiff) {
+            best = w;
+            bestDiff = diff;
+        }
+    }
+    return best;
+}
+
+QGeometryData Simplifier::simplify(int targetTriangles)
+{
+    while (liveTriangles > targetTriangles && !heap.empty()) {
+        Collapse c = heap.top();
+        heap.pop();
+
+        // outdated by an earlier collapse
+        if (find(c.keep) != c.keep || find(c.remove) != c.remove) continue;
+        if (stamp[c.keep] != c.keepStamp || stamp[c.remove] != c.removeStamp) continue;
+        if (flips(c.remove, c.keep)) continue;
+
+        collapse(c.keep, c.remove);
+    }
+
+    bool hasNormal = geometry.hasField(QGL::Normal);
+    bool hasTexCoord = geometry.hasField(QGL::TextureCoord0);
+
+    QGeometryData result;
+    QHash<int, int> newIndex;
+    for (int t = 0; t < dead.size(); ++t) {
+        if (dead[t]) continue;
+        for (int i = 0; i < 3; ++i) {
+            int v = original[t * 3 + i];
+            auto it = newIndex.find(v);
+            if (it == newIndex.end()) {
+                it = newIndex.insert(v, result.count());
+                result.appendVertex(geometry.vertexAt(v));
+                if (hasNormal) result.appendNormal(geometry.normalAt(v));
+                if (hasTexCoord) result.appendTexCoord(geometry.texCoordAt(v));
+            }
+            result.appendIndex(*it);
+        }
+    }
+    return result;
+}
+
+}
+
+void MeshLod::generate(QGLSceneNode *root)
+{
+    QList<MeshPart> parts = collectParts(root);
+
+    for (const MeshPart &part : parts) {
+        int triangles = part.count / 3;
+        if (part.mode != QGL::Triangles || triangles < MinTriangles) continue;
+
+        // each level continues simplifying the previous one
+        Simplifier simplifier(part.geometry, part.start, part.count);
+        QVector<QGeometryData> partLevels;
+        int previous = triangles;
+        for (qreal ratio : LevelRatio) {
+            QGeometryData level = simplifier.simplify(qMax(4, int(triangles * ratio)));
+
+            // no further reduction possible, use the last level
+            int levelTriangles = level.indexCount() / 3;
+            if (levelTriangles == 0 || levelTriangles >= previous) break;
+            partLevels << level;
+            previous = levelTriangles;
+        }
+
+        if (partLevels.isEmpty()) continue;
+        QMutexLocker locker(&mutex);
+        levels.insert(part.node, partLevels);
+    }
+}
+
+int MeshLod::levelForSize(qreal pixels)
+{
+    int level = 0;
+    while (level < LevelCount && pixels < LevelSize[level]) ++level;
+    return level;
+}
+
+void MeshLod::select(MeshPart &part, int level)
+{
+    if (level == 0 || !part.node) return;
+
+    QMutexLocker locker(&mutex);
+    auto it = levels.constFind(part.node);
+    if (it == levels.constEnd()) return;
+
+    // fall back to the simplest level generated
+    const QGeometryData &geometry = it->at(qMin(level, it->size()) - 1);
+    part.geometry = geometry;
+    part.start = 0;
+    part.count = geometry.indexCount();
+}
@@ -0,0 +1,45 @@
+#ifndef MESHLOD_H
+#define MESHLOD_H
+
+#include <Qt3D/QGeometryData>
+
+class QGLSceneNode;
+struct MeshPart;
+
+/**
+ * \brief Simplified levels of detail of loaded meshes
+ *
+ * When a model is imported, the geometry of every node is simplified to
+ * 50%, 10% and 2% of its triangles by quadric error metric edge collapses.
+ * Vertices sharing a position are welded first, so that seams of texture
+ * coordinates do not tear. Each edge collapses to the endpoint of lower
+ * error; collapses flipping a triangle are rejected. Corners keep the
+ * normal and texture coordinates of their own vertex, and a moved corner
+ * takes those of the closest vertex at the new position, so hard edges and
+ * texture seams survive.
+ *
+ * Levels are kept in a registry keyed by node, from the import until the
+ * mesh is evicted. The level to draw is chosen by the size of the mesh
+ * projected on screen.
+ *
+ * generate() may be called from the loader thread, other functions from
+ * the main thread.
+ */
+
+class MeshLod {
+public:
+    /// Number of simplified levels, level 0 is the original geometry.
+    static const int LevelCount = 3;
+
+    /// Generate simplified levels for all nodes under @p root.
+    static void generate(QGLSceneNode *root);
+
+    /// Return the level to draw for a mesh of @p pixels on screen.
+    static int levelForSize(qreal pixels);
+
+    /// Replace the geometry of @p part by its simplified @p level,
+    /// leave it unchanged if there is no such level.
+    static void select(MeshPart &part, int level);
+};
+
+#endif
@@ -1,13 +1,35 @@
 #include "outlinepainter.h"
 #include "common.h"
+#include "shadereffect.h"
 #include <Qt3D/QGLBuilder>
 #include <Qt3D/QGLFramebufferObjectSurface>
-#include <Qt3D/QGLShaderProgramEffect>
 #include <QtGui/QOpenGLFramebufferObject>
 #include <QtGui/QOpenGLShaderProgram>
+#include <QtGui/QOpenGLTimerQuery>
 
 #include <QtGui/QOpenGLFunctions>
 #include <QtGui/QOpenGLContext>
+#include <QtGui/QVector2D>
+#include <QtCore/qmath.h>
+
+#include <QtCore/QDebug>
+
+/* Distance between blur taps, in pixels of the window */
+static const float Spread = 2.4f;
+
+/* Reach of the blur out of the object in pixels, 4 taps of Spread */
+static const int Radius = 10;
+
+/* Pixels of @p rect in normalized device coordinates on a target
+ * of @p size, grown by @p margin pixels */
+static QRect pixelRect(const QRectF &rect, const QSize &size, int margin)
+{
+    QRect pixels(QPoint(qFloor((rect.left() + 1) * 0.5 * size.width()) - margin,
+                        qFloor((rect.top() + 1) * 0.5 * size.height()) - margin),
+                 QPoint(qCeil((rect.right() + 1) * 0.5 * size.width()) + margin,
+                        qCeil((rect.bottom() + 1) * 0.5 * size.height()) + margin));
+    return pixels & QRect(QPoint(0, 0), size);
+}
 
 OutlinePainter::OutlinePainter()
 {
@@ -18,37 +40,124 @@ OutlinePainter::OutlinePainter()
 
     node->setMaterial(new QGLMaterial());
 
-    hblur = new QGLShaderProgramEffect();
+    hblur = new ShaderEffect();
     hblur->setVertexShaderFromFile(":/shader/ortho.vsh");
     hblur->setFragmentShaderFromFile(":/shader/hblur.fsh");
 
-    vblur = new QGLShaderProgramEffect();
+    vblur = new ShaderEffect();
     vblur->setVertexShaderFromFile(":/shader/ortho.vsh");
     vblur->setFragmentShaderFromFile(":/shader/vblur.fsh");
+
+    floodSeed = new ShaderEffect();
+    floodSeed->setVertexShaderFromFile(":/shader/ortho.vsh");
+    floodSeed->setFragmentShaderFromFile(":/shader/floodseed.fsh");
+
+    floodStep = new ShaderEffect();
+    floodStep->setVertexShaderFromFile(":/shader/ortho.vsh");
+    floodStep->setFragmentShaderFromFile(":/shader/floodstep.fsh");
+
+    floodOutline = new ShaderEffect();
+    floodOutline->setVertexShaderFromFile(":/shader/ortho.vsh");
+    floodOutline->setFragmentShaderFromFile(":/shader/floodoutline.fsh");
 }
 
-void OutlinePainter::draw(QGLPainter *painter, int tex)
+void OutlinePainter::resize(const QSize &size)
 {
-    if (!fbo) {
-        Q_ASSERT(!surface && !glFunc);
+    delete surface;
+    delete fbo;
+    fbo = new QOpenGLFramebufferObject(size);
+    surface = new QGLFramebufferObjectSurface(fbo);
+
+    // smooth when stretched over the window at half resolution
+    glBindTexture(GL_TEXTURE_2D, fbo->texture());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-        fbo = new QOpenGLFramebufferObject(800, 600, QOpenGLFramebufferObject::CombinedDepthStencil);
-        surface = new QGLFramebufferObjectSurface(fbo);
+void OutlinePainter::draw(QGLPainter *painter, int tex, const QRectF &bounds)
+{
+    if (!glFunc)
         glFunc = new QOpenGLFunctions(QOpenGLContext::currentContext());
-    }
 
     if (painter->isPicking() && hoveringId == -1) return;
 
+    if (!timer) {
+        timer = new QOpenGLTimerQuery;
+        if (!timer->create())
+            qDebug() << "Timer queries not supported, outline is not timed";
+    }
+    collectTime();
+    bool timing = timer->isCreated() && !timerPending;
+    if (timing) {
+        timer->begin();
+        timedMode = mode;
+        timedHalf = halfResolution;
+    }
+
+    QRect viewport = painter->currentSurface()->viewportGL();
+    if (mode == JumpFlood)
+        drawJumpFlood(painter, tex, viewport, bounds);
+    else
+        drawBlur(painter, tex, viewport, bounds);
+
+    if (timing) {
+        timer->end();
+        timerPending = true;
+    }
+}
+
+QString OutlinePainter::stats() const
+{
+    auto average = [&](Mode m, bool half) {
+        int count = timedCount[m][half];
+        return (count ? QString::number(totalTime[m][half] / count, 'f', 3) + " ms"
+                      : QString("n/a")) + QString(" (%1 draws)").arg(count);
+    };
+    return QString("blur %1, at half resolution %2; "
+                   "jump flood %3, at half resolution %4; width %5")
+        .arg(average(Blur, false)).arg(average(Blur, true))
+        .arg(average(JumpFlood, false)).arg(average(JumpFlood, true)).arg(width);
+}
+
+/* Add the time of the last timed draw if the GPU is done with it */
+void OutlinePainter::collectTime()
+{
+    if (!timerPending || !timer->isResultAvailable()) return;
+    totalTime[timedMode][timedHalf] += timer->waitForResult() / 1e6;
+    ++timedCount[timedMode][timedHalf];
+    timerPending = false;
+}
+
+void OutlinePainter::drawBlur(QGLPainter *painter, int tex, const QRect &viewport, const QRectF &bounds)
+{
+    QSize size = halfResolution ? viewport.size() / 2 : viewport.size();
+    if (!fbo || fbo->size() != size)
+        resize(size);
+
+    // pass 2 covers the reach of the blur, and reads pass 1 as far again
+    QRect outer = pixelRect(bounds, viewport.size(), Radius);
+    QRect inner = pixelRect(bounds, size, qCeil(2 * Radius * qreal(size.width()) / viewport.width()) + 1);
+    if (outer.isEmpty()) return;
+
+    // offsets between taps in texture coordinates, the same at any resolution
+    QVector2D offset(Spread / viewport.width(), Spread / viewport.height());
+    QVector2D texel(1.0f / viewport.width(), 1.0f / viewport.height());
+
+    glEnable(GL_SCISSOR_TEST);
+
     /* Pass 1: detect target and horizontal blur, from picking buffer to fbo */
 
     // initialize fbo and surface
     painter->pushSurface(surface);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glScissor(inner.x(), inner.y(), inner.width(), inner.height());
+    glClear(GL_COLOR_BUFFER_BIT);
 
     // initialize shader
     node->setUserEffect(hblur);
     painter->setUserEffect(hblur);
     hblur->program()->setUniformValue("target", hoveringPickColor);
+    hblur->program()->setUniformValue("offset", offset);
 
     glEnable(GL_BLEND);
 
@@ -67,10 +176,14 @@ void OutlinePainter::draw(QGLPainter *painter, int tex)
 
     /* Pass 2: vertical blur and remove central area, from fbo to main buffer */
 
+    glScissor(viewport.x() + outer.x(), viewport.y() + outer.y(), outer.width(), outer.height());
+
     // initialize shader
     node->setUserEffect(vblur);
     painter->setUserEffect(vblur);
     vblur->program()->setUniformValue("target", hoveringPickColor);
+    vblur->program()->setUniformValue("offset", offset);
+    vblur->program()->setUniformValue("texel", texel);
 
     glEnable(GL_BLEND);
 
@@ -92,5 +205,109 @@ void OutlinePainter::draw(QGLPainter *painter, int tex)
     glDisable(GL_TEXTURE_2D);
 
     glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
+    painter->setUserEffect(NULL);
+}
+
+void OutlinePainter::drawJumpFlood(QGLPainter *painter, int tex, const QRect &viewport, const QRectF &bounds)
+{
+    QSize size = halfResolution ? viewport.size() / 2 : viewport.size();
+    if (!floodFbo[0] || floodFbo[0]->size() != size) {
+        for (int i = 0; i < 2; ++i) {
+            delete floodSurface[i];
+            delete floodFbo[i];
+            floodFbo[i] = new QOpenGLFramebufferObject(size);
+            floodSurface[i] = new QGLFramebufferObjectSurface(floodFbo[i]);
+
+            // positions must not be interpolated
+            glBindTexture(GL_TEXTURE_2D, floodFbo[i]->texture());
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+    }
+
+    // the width in pixels of the targets, at half resolution half as many
+    qreal scale = qreal(size.width()) / viewport.width();
+    int floodWidth = qMax(1, qCeil(width * scale));
+
+    // jumps from the power of 2 covering the width down to 1 pixel
+    int firstJump = 1;
+    while (firstJump < floodWidth) firstJump *= 2;
+
+    // the outline, and around it what the passes read, cleared to no position
+    QRect outer = pixelRect(bounds, viewport.size(), width);
+    QRect floodOuter = pixelRect(bounds, size, floodWidth + 1);
+    QRect cleared = pixelRect(bounds, size, floodWidth + 1 + firstJump);
+    if (outer.isEmpty()) return;
+
+    QVector2D texel(1.0f / size.width(), 1.0f / size.height());
+
+    glEnable(GL_SCISSOR_TEST);
+
+    /* Seed: pixels of the target marked with their position */
+
+    glFunc->glActiveTexture(GL_TEXTURE0);
+    painter->pushSurface(floodSurface[1]);
+    glScissor(cleared.x(), cleared.y(), cleared.width(), cleared.height());
+    glClear(GL_COLOR_BUFFER_BIT);
+    painter->popSurface();
+
+    painter->pushSurface(floodSurface[0]);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glScissor(floodOuter.x(), floodOuter.y(), floodOuter.width(), floodOuter.height());
+
+    node->setUserEffect(floodSeed);
+    painter->setUserEffect(floodSeed);
+    floodSeed->program()->setUniformValue("target", hoveringPickColor);
+    floodSeed->program()->setUniformValue("texel", texel);
+
+    glBindTexture(GL_TEXTURE_2D, tex);
+    node->draw(painter);
+    painter->popSurface();
+
+    /* Flood: each pixel keeps the nearest position among 9 at the jump */
+
+    node->setUserEffect(floodStep);
+    painter->setUserEffect(floodStep);
+    floodStep->program()->setUniformValue("texel", texel);
+
+    int current = 0;
+    for (int jump = firstJump; jump >= 1; jump /= 2) {
+        painter->pushSurface(floodSurface[1 - current]);
+        floodStep->program()->setUniformValue("jump", GLfloat(jump));
+        glBindTexture(GL_TEXTURE_2D, floodFbo[current]->texture());
+        node->draw(painter);
+        painter->popSurface();
+        current = 1 - current;
+    }
+
+    /* Outline: faded by the distance to the nearest position */
+
+    glScissor(viewport.x() + outer.x(), viewport.y() + outer.y(), outer.width(), outer.height());
+
+    node->setUserEffect(floodOutline);
+    painter->setUserEffect(floodOutline);
+    floodOutline->program()->setUniformValue("target", hoveringPickColor);
+    floodOutline->program()->setUniformValue("texel", texel);
+    floodOutline->program()->setUniformValue("width", GLfloat(width * scale));
+
+    glEnable(GL_BLEND);
+
+    // bind texture 0 (positions) and texture 1 (picking buffer)
+    glFunc->glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, floodFbo[current]->texture());
+    glFunc->glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, tex);
+
+    node->draw(painter);
+
+    // clean up
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glFunc->glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
     painter->setUserEffect(NULL);
 }
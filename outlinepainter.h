@@ -1,12 +1,17 @@
 #ifndef OUTLINEPAINTER_H
 #define OUTLINEPAINTER_H
 
+#include <QtCore/QRectF>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+
 class QGLPainter;
 class QGLSceneNode;
-class QGLShaderProgramEffect;
 class QGLFramebufferObjectSurface;
+class ShaderEffect;
 class QOpenGLFramebufferObject;
 class QOpenGLFunctions;
+class QOpenGLTimerQuery;
 
 /**
  * \brief The painter of outline (glow) effect
@@ -31,22 +36,82 @@ class QOpenGLFunctions;
  * The second pass blur the FBO vertically, removes central area, and
  * paint it to screen. See the shaders for details.
  *
- * TODO: Currently the outline is not multisampled.
+ * The intermediate FBO follows the size of the window, optionally at half
+ * resolution, and both passes are scissored to the screen area of the
+ * object grown by the reach of the blur, so the cost follows the size of
+ * the object rather than the window.
+ *
+ * The picking buffer cannot be multisampled, as ids must not be blended.
+ * Instead, the central area is removed by the coverage of the object in
+ * the pixel and its neighbours, so the inner edge is as soft as the
+ * multisampled edge of the object under it.
+ *
+ * In JumpFlood mode, pixels of the object are marked with their own
+ * position, then log2(width) passes of jump flooding spread the nearest
+ * marked position to every pixel within the outline width, and the last
+ * pass fades the outline by the distance to it. Any width costs a few
+ * passes of 9 taps, and pick colors are compared exactly. At half
+ * resolution, positions are flooded on targets of half the size, and the
+ * last pass measures the distance at the full resolution of the window.
+ *
+ * Each draw is timed with a GPU timer query if supported, to compare
+ * the modes (see stats()).
  */
 
 class OutlinePainter {
 public:
+    enum Mode { Blur, JumpFlood };
+
     /// Initialize outline painter.
     OutlinePainter();
-    /// Take the picking buffer as @p texture, draw outline to @p painter.
-    void draw(QGLPainter *painter, int texture);
+
+    /// Set the way the outline is drawn.
+    inline void setMode(Mode mode) { this->mode = mode; }
+    inline Mode getMode() const { return mode; }
+
+    /// Set the width of the outline in JumpFlood mode, in pixels.
+    inline void setWidth(int width) { this->width = width; }
+
+    /// Blur, or flood in JumpFlood mode, at half the resolution of the
+    /// window if @p half is true.
+    inline void setHalfResolution(bool half) { halfResolution = half; }
+    inline bool isHalfResolution() const { return halfResolution; }
+
+    /// Take the picking buffer as @p texture, draw outline to @p painter
+    /// around the object within @p bounds in normalized device coordinates.
+    void draw(QGLPainter *painter, int texture, const QRectF &bounds = QRectF(-1, -1, 2, 2));
+
+    /// Return the average GPU time of draws in each mode, at full and
+    /// half resolution.
+    QString stats() const;
 
 private:
+    void resize(const QSize &size);
+    void drawBlur(QGLPainter *painter, int texture, const QRect &viewport, const QRectF &bounds);
+    void drawJumpFlood(QGLPainter *painter, int texture, const QRect &viewport, const QRectF &bounds);
+    void collectTime();
+
     QGLSceneNode *node;
-    QGLShaderProgramEffect *hblur, *vblur;
+    ShaderEffect *hblur, *vblur;
     QOpenGLFramebufferObject *fbo = nullptr;
     QGLFramebufferObjectSurface *surface = nullptr;
     QOpenGLFunctions *glFunc = nullptr;
+    bool halfResolution = false;
+
+    // jump flooding, ping-pong between two targets of the blur size
+    Mode mode = Blur;
+    int width = 8;
+    ShaderEffect *floodSeed, *floodStep, *floodOutline;
+    QOpenGLFramebufferObject *floodFbo[2] = {nullptr, nullptr};
+    QGLFramebufferObjectSurface *floodSurface[2] = {nullptr, nullptr};
+
+    // one draw timed at a time, read without waiting in a later frame
+    QOpenGLTimerQuery *timer = nullptr;
+    bool timerPending = false;
+    Mode timedMode;
+    bool timedHalf;
+    double totalTime[2][2] = {{0, 0}, {0, 0}};  // in milliseconds, by mode and half
+    int timedCount[2][2] = {{0, 0}, {0, 0}};
 };
 
 #endif
@@ -1,27 +1,126 @@
 #include "view.h"
+#include "backgroundcache.h"
 #include "common.h"
 #include "directory.h"
 #include "outlinepainter.h"
+#include "raypicker.h"
+#include "renderqueue.h"
+#include "resourcemanager.h"
 #include "room.h"
+#include "shadereffect.h"
+#include "textrenderer.h"
+#include "trace.h"
 #include <Qt3D/QGLFramebufferObjectSurface>
-#include <Qt3D/QGLShaderProgramEffect>
 #include <Qt3D/QGLSceneNode>
+#include <QtCore/qmath.h>
+#include <QtCore/QTimer>
+#include <QtGui/QOpenGLFramebufferObject>
 #include <QtGui/QOpenGLShaderProgram>
 
+#include <QtCore/QDebug>
+
 inline QMatrix4x4 calcMvp(const QGLCamera *camera, const QSize &size);
 
+/* Screen fraction of the chest opening above which the next room
+ * is painted as geometry instead of its captured image */
+static const qreal ImpostorCoverage = 0.2;
+
 inline QVector3D rotateCcw(QVector3D vec, qreal angle)
 {
     return QQuaternion::fromAxisAndAngle(0, 1, 0, angle).rotatedVector(vec);
 }
 
+/* Screen area of a portal in normalized device coordinates,
+ * or the whole screen if it is not entirely in front of the eye */
+static QRectF portalRect(const QMatrix4x4 &mvp, const QVector<QVector3D> &corners)
+{
+    const QRectF screen(-1, -1, 2, 2);
+    if (corners.isEmpty()) return screen;
+
+    qreal left = 1, right = -1, bottom = 1, top = -1;
+    for (const QVector3D &corner : corners) {
+        QVector4D p = mvp * QVector4D(corner, 1);
+        if (p.w() <= 0) return screen;
+        left = qMin(left, p.x() / p.w());
+        right = qMax(right, p.x() / p.w());
+        bottom = qMin(bottom, p.y() / p.w());
+        top = qMax(top, p.y() / p.w());
+    }
+
+    return QRectF(left, bottom, right - left, top - bottom) & screen;
+}
+
 void View::paintGL(QGLPainter *painter)
 {
     if (painter->isPicking()) {
+        // ids that may be drawn, the entries following the slots
+        QList<QPair<int, int> > ranges;
+        ranges << qMakePair(objectId(EntryKind, 0), objectId(EntryKind, curRoom->countSlot() - 1))
+               << qMakePair(int(TrashBin), int(Image))
+               << qMakePair(int(ImagePrevBtn), int(ImageNextBtn));
+        setObjectIdRanges(ranges);
+
         curRoom->paintFront(painter);
         return;
     }
 
+    // changes made while painting schedule another frame
+    int flags = dirty;
+    dirty = 0;
+
+    QSize size = painter->currentSurface()->viewportGL().size();
+    if (!sceneFbo || sceneFbo->size() != size) {
+        createSceneBuffer(size);
+        flags |= SceneDirty;
+    }
+    // the camera moves during animation
+    if (animStage != NoAnim) flags |= SceneDirty;
+
+    if (flags & SceneDirty) {
+        painter->pushSurface(sceneSurface);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        paintScene(painter);
+        painter->popSurface();
+
+        if (sceneTexFbo != sceneFbo)
+            QOpenGLFramebufferObject::blitFramebuffer(sceneTexFbo, sceneFbo);
+    }
+    paintCachedScene(painter);
+
+    // the HUD is rebuilt once the animation is over
+    if (enteringDir != -1 || leavingDoor != -1) {
+        dirty |= flags & HudDirty;
+        return;
+    }
+    // else no animation
+
+    if (hoveringId != -1)
+        paintOutline(painter);
+
+    paintHud(painter, flags);
+
+    // adjacent pages are built after the frame is presented
+    if (curRoom->hasColdPages(labels))
+        QTimer::singleShot(0, this, [=]() {
+            if (curRoom->prefetchPages(labels)) invalidate(RoomDirty);
+        });
+
+    if (!firstFramePainted) {
+        firstFramePainted = true;
+        qDebug() << "First frame in" << startupTimer.elapsed() << "ms";
+    }
+}
+
+void View::invalidate(int flags)
+{
+    dirty |= flags;
+    if (flags & SceneDirty) invalidatePickBuffer();
+    if (flags & (RoomDirty | PickedDirty)) pickerDirty = true;
+    if (!applyingMove) update();
+}
+
+void View::paintScene(QGLPainter *painter)
+{
     painter->removeLight(0);
     painter->addLight(light);
 
@@ -30,24 +129,58 @@ void View::paintGL(QGLPainter *painter)
     phongEffect->program()->setUniformValue("diffuseColor", 1.0f, 1.0f, 1.0f, 1.0f);
     phongEffect->program()->setUniformValue("specularColor", 1.0f, 1.0f, 1.0f, 1.0f);
 
+    queue->resetStats();
     updateCamera();
     paintCurrentRoom(painter);
     if (animStage > NoAnim && animStage < Leaving3)
         paintNextRoom(painter);
 
-    if (enteringDir != -1 || leavingDoor != -1) return;
-    // else no animation
-
-    if (hoveringId != -1)
-        paintOutline(painter);
-
-    if (pickedEntry != -1) {
+    if (pickedEntry != -1 && enteringDir == -1 && leavingDoor == -1) {
         if (deltaPos.length() > 1) isNear = false;
         if (!isNear) glClear(GL_DEPTH_BUFFER_BIT);
-        curRoom->paintPickedEntry(painter, deltaPos);
+        curRoom->queuePickedEntry(queue, painter, deltaPos);
+        queue->flush(painter);
     }
+}
 
-    paintHud(painter);
+void View::createSceneBuffer(const QSize &size)
+{
+    if (sceneTexFbo != sceneFbo) delete sceneTexFbo;
+    delete sceneFbo;
+    delete sceneSurface;
+
+    // multisampled like the window, resolved into a texture after painting
+    QOpenGLFramebufferObjectFormat fboFormat;
+    fboFormat.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+    if (QOpenGLFramebufferObject::hasOpenGLFramebufferBlit())
+        fboFormat.setSamples(format().samples());
+    sceneFbo = new QOpenGLFramebufferObject(size, fboFormat);
+    sceneSurface = new QGLFramebufferObjectSurface(sceneFbo);
+
+    sceneTexFbo = sceneFbo;
+    if (sceneFbo->format().samples() > 0)
+        sceneTexFbo = new QOpenGLFramebufferObject(size);
+}
+
+void View::paintCachedScene(QGLPainter *painter)
+{
+    painter->modelViewMatrix().push();
+    painter->modelViewMatrix().setToIdentity();
+    painter->projectionMatrix().push();
+    painter->projectionMatrix().setToIdentity();
+
+    QGLAbstractEffect *prevEffect = painter->userEffect();
+    painter->setUserEffect(copyEffect);
+
+    glDisable(GL_DEPTH_TEST);
+    glBindTexture(GL_TEXTURE_2D, sceneTexFbo->texture());
+    sceneQuad->draw(painter);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glEnable(GL_DEPTH_TEST);
+
+    painter->setUserEffect(prevEffect);
+    painter->modelViewMatrix().pop();
+    painter->projectionMatrix().pop();
 }
 
 void View::updateCamera()
@@ -104,13 +237,38 @@ void View::paintCurrentRoom(QGLPainter *painter)
         prog = 1.0;
     }
 
-    curRoom->paintFront(painter, id, prog);
+    // the eye only stays while roaming, turning and sliding pages
+    bool cached = backgroundCached
+        && (animStage == NoAnim || animStage == TurningLeft || animStage == TurningRight
+            || animStage == SlidingPage);
+    if (cached) paintBackground(painter);
+
+    curRoom->setPageSlide(animStage == SlidingPage ? slideDelta * (1 - animProg) : 0.0);
+
+    curRoom->queueFront(queue, painter, id, prog, !cached);
+    queue->flush(painter);
+
+    if (showLabels) curRoom->paintLabels(painter, labels);
 }
 
-void View::paintNextRoom(QGLPainter *painter)
+void View::paintBackground(QGLPainter *painter)
 {
-    painter->removeLight(lightId);
+    QVector3D eye = camera()->eye();
+    if (!background->isValid(curRoom, eye)) {
+        painter->removeLight(lightId);
+        background->render(painter, queue, curRoom, eye, light);
+        lightId = painter->addLight(light);
+    }
+
+    background->draw(painter);
 
+    // the shell still hides items behind it
+    curRoom->queueShell(queue, painter);
+    queue->flush(painter, true);
+}
+
+void View::paintNextRoom(QGLPainter *painter)
+{
     // first slow, then quick, then slow
     qreal t = animProg;
     if (t > 0.5) {
@@ -122,6 +280,38 @@ void View::paintNextRoom(QGLPainter *painter)
     camera()->setEye(startEye + t * deltaEye);
     camera()->setUpVector(startUp + t * deltaUp);
 
+    // the next room is only seen through the chest opening or the door
+    QVector<QVector3D> corners = enteringDir != -1 ?
+            curRoom->getEntryPortal(enteringDir) : curRoom->getDoorPortal();
+    QRectF portal = portalRect(painter->combinedMatrix(), corners);
+    if (portal.isEmpty()) return;
+
+    // while the opening is small, its captured image is good enough
+    if (animStage == Entering1 && !impostorDone && !corners.isEmpty()) {
+        if (portal.width() * portal.height() / 4 < ImpostorCoverage) {
+            paintImpostor(painter, corners);
+            return;
+        }
+        // real geometry until the end of animation, no popping back
+        impostorDone = true;
+    }
+
+    QRect viewport = painter->currentSurface()->viewportGL();
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(viewport.x() + qFloor((portal.left() + 1) * 0.5 * viewport.width()),
+            viewport.y() + qFloor((portal.top() + 1) * 0.5 * viewport.height()),
+            qCeil(portal.width() * 0.5 * viewport.width()) + 1,
+            qCeil(portal.height() * 0.5 * viewport.height()) + 1);
+    queue->setClipRect(portal);
+
+    paintNextRoomContent(painter);
+
+    queue->setClipRect(QRectF());
+    glDisable(GL_SCISSOR_TEST);
+}
+
+void View::paintNextRoomContent(QGLPainter *painter)
+{
     painter->modelViewMatrix().push();
     if (enteringDir != -1) {
         // paint inside
@@ -134,9 +324,12 @@ void View::paintNextRoom(QGLPainter *painter)
         painter->modelViewMatrix().translate(-curRoom->getOutPos() - QVector3D(0, 0.1, 0));
     }
 
+    painter->removeLight(lightId);
     int tmpLightId = painter->addLight(light);
 
-    curRoom->paintBack(painter, animStage);
+    // flushed here because lights differ from the current room
+    curRoom->queueBack(queue, painter, animStage);
+    queue->flush(painter);
 
     painter->modelViewMatrix().pop();
 
@@ -144,47 +337,109 @@ void View::paintNextRoom(QGLPainter *painter)
     lightId = painter->addLight(light);
 }
 
-void View::paintOutline(QGLPainter *painter)
+void View::paintImpostor(QGLPainter *painter, const QVector<QVector3D> &corners)
 {
-    // FIXME: unable to reuse pick buffer of GLView
+    QSize size = painter->currentSurface()->viewportGL().size();
+    if (impostorFbo && impostorFbo->size() != size) {
+        delete impostorSurface;
+        delete impostorFbo;
+        impostorFbo = NULL;
+        impostorSurface = NULL;
+    }
+    if (!impostorFbo) {
+        impostorFbo = new QOpenGLFramebufferObject(size, QOpenGLFramebufferObject::CombinedDepthStencil);
+        impostorSurface = new QGLFramebufferObjectSurface(impostorFbo);
+        impostorValid = false;
+    }
 
-    if (!fbo) {
-        fbo = new QOpenGLFramebufferObject(size(), QOpenGLFramebufferObject::CombinedDepthStencil);
-        surface = new QGLFramebufferObjectSurface(fbo);
+    // captured once, again only if meshes of the next room arrive
+    if (!impostorValid || impostorGeneration != resources.meshGeneration()) {
+        painter->pushSurface(impostorSurface);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        paintNextRoomContent(painter);
+        painter->popSurface();
+
+        // from clip coordinates of this view to texture coordinates
+        impostorMatrix.setToIdentity();
+        impostorMatrix.translate(0.5, 0.5, 0.5);
+        impostorMatrix.scale(0.5);
+        impostorMatrix *= painter->combinedMatrix();
+
+        impostorValid = true;
+        impostorGeneration = resources.meshGeneration();
     }
 
-    painter->pushSurface(surface);
-    painter->setPicking(true);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // the opening as two triangles, textured by projection of the image
+    QGeometryData quad;
+    for (const QVector3D &corner : corners)
+        quad.appendVertex(corner);
+    quad.appendIndices(0, 1, 2);
+    quad.appendIndices(0, 2, 3);
 
-    curRoom->paintFront(painter);
+    QGLAbstractEffect *prevEffect = painter->userEffect();
+    painter->setUserEffect(impostorEffect);
+    impostorEffect->program()->setUniformValue("captureMatrix", impostorMatrix);
 
-    painter->setPicking(false);
-    painter->popSurface();
+    glBindTexture(GL_TEXTURE_2D, impostorFbo->texture());
+    quad.draw(painter, 0, 6, QGL::Triangles);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-    outline->draw(painter, fbo->texture());
+    painter->setUserEffect(prevEffect);
 }
 
-static const char *ItemName[] = {
-    "ERROR!!!",
+void View::paintOutline(QGLPainter *painter)
+{
+    // the same buffer answers hover queries, painted again only if invalid
+    QOpenGLFramebufferObject *pick = pickBuffer(painter);
+    hoveringPickColor = pickColorForObject(hoveringId);
+
+    outline->draw(painter, pick->texture(), hoverBounds());
+}
+
+/* Screen area of the hovered object in normalized device coordinates,
+ * from its boxes in the ray picker */
+QRectF View::hoverBounds()
+{
+    updatePicker();
+    QBox3D box = picker->bounds(hoveringId);
+    if (box.isNull()) return QRectF(-1, -1, 2, 2);
+
+    QVector<QVector3D> corners;
+    for (int i = 0; i < 8; ++i)
+        corners << QVector3D(i & 1 ? box.maximum().x() : box.minimum().x(),
+                             i & 2 ? box.maximum().y() : box.minimum().y(),
+                             i & 4 ? box.maximum().z() : box.minimum().z());
+
+    QMatrix4x4 mvp = camera()->projectionMatrix(qreal(width()) / height())
+        * camera()->modelViewMatrix();
+    return portalRect(mvp, corners);
+}
+
+/* Names of solids by index */
+static const char *SolidName[] = {
     "Trash Bin",
     "Door",
     "Previous Page",
     "Next Page",
     "Music Player",
-    "Image Viewer",
-    "Image Viewer",
     "Image Viewer"
 };
 
-void View::paintHud(QGLPainter *painter)
+void View::paintHud(QGLPainter *painter, int flags)
 {
-    if (hoveringId > MaxEntryCnt) {
-        QVector3D pos = calcMvp(camera(), size()) * curRoom->getSolidPos(hoveringId);
-        updateHudContent(pos.x(), pos.y(), ItemName[hoveringId - MaxEntryCnt]);
-    } else if (hoveringId != -1 && hoveringId < dir->count()) {
+    // the name follows the hovered object on screen
+    bool moved = flags & (CameraDirty | HoverDirty | HudDirty);
+    ObjectKind kind = objectKind(hoveringId);
+    if (moved && (kind == SolidKind || kind == ButtonKind)) {
+        // buttons are labelled as the image viewer
+        int solid = kind == ButtonKind ? int(Image) : hoveringId;
+        QVector3D pos = calcMvp(camera(), size()) * curRoom->getSolidPos(solid);
+        updateHudContent(pos.x(), pos.y(), SolidName[objectIndex(solid)]);
+    } else if (moved && kind == EntryKind && hoveringId < dir->count()) {
         QVector3D pos = calcMvp(camera(), size()) * curRoom->getEntryPos(hoveringId);
         updateHudContent(pos.x(), pos.y(), dir->entry(hoveringId));
+    } else if (flags & HudDirty) {
+        updateHudContent();
     }
 
     painter->modelViewMatrix().push();
@@ -192,11 +447,9 @@ void View::paintHud(QGLPainter *painter)
     painter->projectionMatrix().push();
     painter->projectionMatrix().setToIdentity();
 
-    glClear(GL_DEPTH_BUFFER_BIT);
-
-    glEnable(GL_BLEND);
-    hud->draw(painter);
-    glDisable(GL_BLEND);
+    queue->add(painter, hud->node(painter->currentSurface()->viewportGL().size()),
+            -1, RenderQueue::Overlay);
+    queue->flush(painter);
 
     painter->modelViewMatrix().pop();
     painter->projectionMatrix().pop();
@@ -204,42 +457,31 @@ void View::paintHud(QGLPainter *painter)
 
 void View::updateHudContent(qreal x, qreal y, QString text)
 {
-    QImage image(width(), height(), QImage::Format_ARGB32_Premultiplied);
-    image.fill(Qt::transparent);
-    QPainter painter(&image);
-    painter.setRenderHint(QPainter::Antialiasing);
-
-    QFont font = painter.font();
-    font.setPointSize(18);
-    font.setBold(1);
-
-    QPainterPath path;
-    if (!text.isEmpty()) path.addText(x, y, font, text);
-    path.addText(0, 20, font, dir->absolutePath());
-    painter.setBrush(QColor(Qt::white));
-    painter.setPen(QColor(Qt::black));
-    painter.drawPath(path);
-
-    QGLTexture2D *tex = hud->material()->texture();
-    if (tex) {
-        tex->release();
-        tex->deleteLater();
-    }
-    tex = new QGLTexture2D();
-    tex->setImage(image);
-    hud->material()->setTexture(tex);
+    hud->clear();
+    if (!text.isEmpty()) hud->addText(QPointF(x, y), text);
+    hud->addText(QPointF(0, 20), dir->absolutePath());
 }
 
 void View::setupLight()
 {
-    phongEffect = new QGLShaderProgramEffect();
+    TraceSpan span("View::setupLight");
+
+    phongEffect = new ShaderEffect();
     phongEffect->setVertexShaderFromFile(":/shader/phong.vsh");
     phongEffect->setFragmentShaderFromFile(":/shader/phong.fsh");
 
-    boxEffect = new QGLShaderProgramEffect();
+    boxEffect = new ShaderEffect();
     boxEffect->setVertexShaderFromFile(":/shader/box.vsh");
     boxEffect->setFragmentShaderFromFile(":/shader/box.fsh");
 
+    copyEffect = new ShaderEffect();
+    copyEffect->setVertexShaderFromFile(":/shader/ortho.vsh");
+    copyEffect->setFragmentShaderFromFile(":/shader/copy.fsh");
+
+    impostorEffect = new ShaderEffect();
+    impostorEffect->setVertexShaderFromFile(":/shader/impostor.vsh");
+    impostorEffect->setFragmentShaderFromFile(":/shader/impostor.fsh");
+
     light = new QGLLightParameters(this);
     light->setPosition(QVector3D(0, roomHeight * 0.5, 0));
     light->setAmbientColor(QColor(120, 120, 120));
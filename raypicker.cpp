@@ -0,0 +1,261 @@
+#include "raypicker.h"
+#include "geometryutil.h"
+#include <Qt3D/QGLSceneNode>
+#include <algorithm>
+
+/* Items in a leaf of the hierarchy */
+static const int LeafSize = 4;
+
+static inline QVector3D minVector(const QVector3D &a, const QVector3D &b)
+{
+    return QVector3D(qMin(a.x(), b.x()), qMin(a.y(), b.y()), qMin(a.z(), b.z()));
+}
+
+static inline QVector3D maxVector(const QVector3D &a, const QVector3D &b)
+{
+    return QVector3D(qMax(a.x(), b.x()), qMax(a.y(), b.y()), qMax(a.z(), b.z()));
+}
+
+RayPicker::~RayPicker()
+{
+    qDeleteAll(meshes);
+}
+
+void RayPicker::clear()
+{
+    instances.clear();
+    treeDirty = true;
+}
+
+void RayPicker::clearMeshes()
+{
+    clear();
+    qDeleteAll(meshes);
+    meshes.clear();
+}
+
+void RayPicker::add(QGLSceneNode *node, const QMatrix4x4 &transform, int id)
+{
+    const Mesh *m = mesh(node);
+    if (m->tree.isEmpty()) return;
+
+    // world box from the corners of the box in the node
+    const TreeNode &root = m->tree.first();
+    Instance instance{m, transform.inverted(), QVector3D(), QVector3D(), id};
+    for (int i = 0; i < 8; ++i) {
+        QVector3D corner(i & 1 ? root.max.x() : root.min.x(),
+                         i & 2 ? root.max.y() : root.min.y(),
+                         i & 4 ? root.max.z() : root.min.z());
+        corner = transform * corner;
+        instance.min = i ? minVector(instance.min, corner) : corner;
+        instance.max = i ? maxVector(instance.max, corner) : corner;
+    }
+
+    instances.append(instance);
+    treeDirty = true;
+}
+
+QBox3D RayPicker::bounds(int id) const
+{
+    QBox3D box;
+    for (const Instance &instance : instances)
+        if (instance.id == id)
+            box.unite(QBox3D(instance.min, instance.max));
+    return box;
+}
+
+int RayPicker::pick(const QVector3D &from, const QVector3D &to)
+{
+    if (treeDirty) buildInstanceTree();
+    if (instanceTree.isEmpty()) return -1;
+
+    // distances are fractions of the segment, kept by affine transforms,
+    // so hits in different instances compare directly
+    QVector3D dir = to - from;
+    QVector3D invDir(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+    float nearest = 1;
+    int nearestId = -1;
+
+    QVector<int> stack;
+    stack << 0;
+    while (!stack.isEmpty()) {
+        int index = stack.takeLast();
+        const TreeNode &node = instanceTree.at(index);
+        if (!hitBox(node, from, invDir, nearest)) continue;
+        if (node.count == 0) {
+            stack << node.start << index + 1;
+            continue;
+        }
+
+        for (int i = node.start; i < node.start + node.count; ++i) {
+            const Instance &instance = instances.at(i);
+            const Mesh *m = instance.mesh;
+            QVector3D localFrom = instance.inverse * from;
+            QVector3D localDir = instance.inverse * to - localFrom;
+            QVector3D localInvDir(1 / localDir.x(), 1 / localDir.y(), 1 / localDir.z());
+
+            QVector<int> meshStack;
+            meshStack << 0;
+            while (!meshStack.isEmpty()) {
+                int meshIndex = meshStack.takeLast();
+                const TreeNode &meshNode = m->tree.at(meshIndex);
+                if (!hitBox(meshNode, localFrom, localInvDir, nearest)) continue;
+                if (meshNode.count == 0) {
+                    meshStack << meshNode.start << meshIndex + 1;
+                    continue;
+                }
+                for (int j = meshNode.start; j < meshNode.start + meshNode.count; ++j) {
+                    float t;
+                    if (hitTriangle(m->vertices.constData() + j * 3, localFrom, localDir, t)
+                            && t < nearest) {
+                        nearest = t;
+                        nearestId = instance.id;
+                    }
+                }
+            }
+        }
+    }
+
+    return nearestId;
+}
+
+/* Return the triangles of @p node, collected on first use */
+const RayPicker::Mesh *RayPicker::mesh(QGLSceneNode *node)
+{
+    Mesh *&m = meshes[node];
+    if (m) return m;
+    m = new Mesh;
+
+    QVector<QVector3D> vertices;
+    for (const MeshPart &part : collectParts(node)) {
+        if (part.mode != QGL::Triangles) continue;
+        QGL::IndexArray indices = part.geometry.indices();
+        for (int i = part.start; i + 2 < part.start + part.count; i += 3)
+            for (int k = 0; k < 3; ++k)
+                vertices.append(part.transform * part.geometry.vertexAt(indices.at(i + k)));
+    }
+
+    int count = vertices.size() / 3;
+    QVector<QVector3D> mins(count), maxs(count);
+    for (int i = 0; i < count; ++i) {
+        mins[i] = minVector(vertices.at(i * 3), minVector(vertices.at(i * 3 + 1), vertices.at(i * 3 + 2)));
+        maxs[i] = maxVector(vertices.at(i * 3), maxVector(vertices.at(i * 3 + 1), vertices.at(i * 3 + 2)));
+    }
+
+    // triangles in the order of leaves
+    QVector<int> order;
+    m->tree = buildTree(mins, maxs, order);
+    m->vertices.reserve(count * 3);
+    for (int i : order)
+        m->vertices << vertices.at(i * 3) << vertices.at(i * 3 + 1) << vertices.at(i * 3 + 2);
+
+    return m;
+}
+
+void RayPicker::buildInstanceTree()
+{
+    QVector<QVector3D> mins, maxs;
+    for (const Instance &instance : instances) {
+        mins << instance.min;
+        maxs << instance.max;
+    }
+
+    // instances in the order of leaves
+    QVector<int> order;
+    instanceTree = buildTree(mins, maxs, order);
+    QVector<Instance> sorted;
+    sorted.reserve(order.size());
+    for (int i : order)
+        sorted << instances.at(i);
+    instances.swap(sorted);
+
+    treeDirty = false;
+}
+
+/* Build a hierarchy of items with boxes @p mins and @p maxs,
+ * and fill @p order with the items in the order of leaves */
+QVector<RayPicker::TreeNode> RayPicker::buildTree(const QVector<QVector3D> &mins,
+        const QVector<QVector3D> &maxs, QVector<int> &order)
+{
+    QVector<TreeNode> tree;
+    order.resize(mins.size());
+    for (int i = 0; i < order.size(); ++i)
+        order[i] = i;
+    if (!order.isEmpty())
+        buildNode(tree, mins, maxs, order, 0, order.size());
+    return tree;
+}
+
+/* Split items at the median of the longest axis of their centers */
+int RayPicker::buildNode(QVector<TreeNode> &tree, const QVector<QVector3D> &mins,
+        const QVector<QVector3D> &maxs, QVector<int> &order, int begin, int end)
+{
+    int index = tree.size();
+    tree.append(TreeNode{mins.at(order.at(begin)), maxs.at(order.at(begin)), begin, end - begin});
+
+    QVector3D centerMin = mins.at(order.at(begin)) + maxs.at(order.at(begin));
+    QVector3D centerMax = centerMin;
+    for (int i = begin; i < end; ++i) {
+        int item = order.at(i);
+        tree[index].min = minVector(tree[index].min, mins.at(item));
+        tree[index].max = maxVector(tree[index].max, maxs.at(item));
+        QVector3D center = mins.at(item) + maxs.at(item);
+        centerMin = minVector(centerMin, center);
+        centerMax = maxVector(centerMax, center);
+    }
+    if (end - begin <= LeafSize) return index;
+
+    QVector3D extent = centerMax - centerMin;
+    int axis = extent.x() > extent.y() ? 0 : 1;
+    if (extent[2] > extent[axis]) axis = 2;
+    if (extent[axis] == 0) return index;
+
+    int mid = (begin + end) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+            [&](int a, int b) { return (mins.at(a) + maxs.at(a))[axis] < (mins.at(b) + maxs.at(b))[axis]; });
+
+    buildNode(tree, mins, maxs, order, begin, mid);
+    int right = buildNode(tree, mins, maxs, order, mid, end);
+    tree[index].start = right;
+    tree[index].count = 0;
+    return index;
+}
+
+/* Slab test of the segment from @p from, up to fraction @p tMax */
+bool RayPicker::hitBox(const TreeNode &node, const QVector3D &from,
+        const QVector3D &invDir, float tMax)
+{
+    float tMin = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        float t1 = (node.min[axis] - from[axis]) * invDir[axis];
+        float t2 = (node.max[axis] - from[axis]) * invDir[axis];
+        if (t1 > t2) qSwap(t1, t2);
+        tMin = qMax(tMin, t1);
+        tMax = qMin(tMax, t2);
+        if (tMin > tMax) return false;
+    }
+    return true;
+}
+
+/* Möller-Trumbore intersection, both sides of the triangle count */
+bool RayPicker::hitTriangle(const QVector3D *v, const QVector3D &from,
+        const QVector3D &dir, float &t)
+{
+    QVector3D e1 = v[1] - v[0];
+    QVector3D e2 = v[2] - v[0];
+    QVector3D p = QVector3D::crossProduct(dir, e2);
+    float det = QVector3D::dotProduct(e1, p);
+    if (det == 0) return false;
+
+    float invDet = 1 / det;
+    QVector3D s = from - v[0];
+    float u = QVector3D::dotProduct(s, p) * invDet;
+    if (u < 0 || u > 1) return false;
+
+    QVector3D q = QVector3D::crossProduct(s, e1);
+    float w = QVector3D::dotProduct(dir, q) * invDet;
+    if (w < 0 || u + w > 1) return false;
+
+    t = QVector3D::dotProduct(e2, q) * invDet;
+    return t >= 0;
+}
@@ -0,0 +1,86 @@
+#ifndef RAYPICKER_H
+#define RAYPICKER_H
+
+#include <Qt3D/QBox3D>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+#include <QtGui/QMatrix4x4>
+
+class QGLSceneNode;
+
+/**
+ * \brief Object picking by casting rays against triangles on the CPU
+ *
+ * Scene nodes are added with the transform and pick id they are drawn
+ * with in picking mode. The triangles of each node are kept in a bounding
+ * volume hierarchy in the space of the node, built on first use and shared
+ * by all instances of the node. Instances are kept in another hierarchy of
+ * their boxes in world space, so a ray only visits the boxes it passes
+ * through.
+ *
+ * Nodes are identified by address, so the triangles must be dropped by
+ * clearMeshes() once nodes may have been deleted.
+ */
+
+class RayPicker {
+public:
+    ~RayPicker();
+
+    /// Remove all instances, keeping the triangles of nodes.
+    void clear();
+
+    /// Remove all instances and the triangles of nodes.
+    void clearMeshes();
+
+    /// Add @p node drawn with @p transform as object @p id.
+    /// Objects with id -1 are not reported, but hide what is behind them.
+    void add(QGLSceneNode *node, const QMatrix4x4 &transform, int id = -1);
+
+    /// Return the box in world space around all instances of object @p id,
+    /// or a null box if there is none.
+    QBox3D bounds(int id) const;
+
+    /// Return the id of the nearest object hit by the segment
+    /// from @p from to @p to, or -1 if none.
+    int pick(const QVector3D &from, const QVector3D &to);
+
+private:
+    // a node of the hierarchy, a leaf if count > 0
+    // (items start ... start + count), otherwise the children are
+    // the next node and the node at start
+    struct TreeNode {
+        QVector3D min, max;
+        int start, count;
+    };
+
+    struct Mesh {
+        QVector<QVector3D> vertices;    // 3 for each triangle
+        QVector<TreeNode> tree;
+    };
+
+    struct Instance {
+        const Mesh *mesh;
+        QMatrix4x4 inverse;
+        QVector3D min, max;
+        int id;
+    };
+
+    const Mesh *mesh(QGLSceneNode *node);
+    void buildInstanceTree();
+
+    static QVector<TreeNode> buildTree(const QVector<QVector3D> &mins,
+            const QVector<QVector3D> &maxs, QVector<int> &order);
+    static int buildNode(QVector<TreeNode> &tree, const QVector<QVector3D> &mins,
+            const QVector<QVector3D> &maxs, QVector<int> &order, int begin, int end);
+    static bool hitBox(const TreeNode &node, const QVector3D &from,
+            const QVector3D &invDir, float tMax);
+    static bool hitTriangle(const QVector3D *v, const QVector3D &from,
+            const QVector3D &dir, float &t);
+
+    QHash<QGLSceneNode*, Mesh*> meshes;
+    QVector<Instance> instances;
+    QVector<TreeNode> instanceTree;
+    bool treeDirty = true;
+};
+
+#endif
@@ -0,0 +1,275 @@
+#include "renderqueue.h"
+#include "common.h"
+#include "instancedmesh.h"
+#include "meshlod.h"
+#include <Qt3D/QGLMaterial>
+#include <Qt3D/QGLAbstractSurface>
+#include <Qt3D/QGLPainter>
+#include <Qt3D/QGLSceneNode>
+#include <QtCore/QSet>
+#include <algorithm>
+
+/* Bounding rect of @p box in normalized device coordinates,
+ * return false if the box crosses the eye plane */
+static bool projectBox(const QMatrix4x4 &mvp, const QBox3D &box, QRectF *rect)
+{
+    QVector3D min = box.minimum(), max = box.maximum();
+
+    qreal left = 1, right = -1, bottom = 1, top = -1;
+    for (int i = 0; i < 8; ++i) {
+        QVector4D p = mvp * QVector4D(i & 1 ? max.x() : min.x(),
+                i & 2 ? max.y() : min.y(), i & 4 ? max.z() : min.z(), 1);
+        if (p.w() <= 0) return false;
+        left = qMin(left, p.x() / p.w());
+        right = qMax(right, p.x() / p.w());
+        bottom = qMin(bottom, p.y() / p.w());
+        top = qMax(top, p.y() / p.w());
+    }
+
+    *rect = QRectF(left, bottom, right - left, top - bottom);
+    return true;
+}
+
+void RenderQueue::add(QGLPainter *painter, QGLSceneNode *node, int id, Layer layer)
+{
+    if (layer == Scene && isCulled(painter, node->boundingBox())) return;
+
+    // simplified geometry for meshes small on screen
+    int level = layer == Scene ? MeshLod::levelForSize(projectedSize(painter, node->boundingBox())) : 0;
+
+    for (const MeshPart &part : collectParts(node, painter->modelViewMatrix().top())) {
+        Item item = newItem(painter, layer, id);
+        item.part = part;
+        item.part.transform = QMatrix4x4();
+        MeshLod::select(item.part, level);
+
+        if (!part.hasEffect) {
+            item.part.hasEffect = true;
+            item.part.userEffect = painter->userEffect();
+            item.part.effect = painter->standardEffect();
+        }
+        item.modelView = part.transform;
+
+        items.append(item);
+    }
+}
+
+void RenderQueue::add(QGLPainter *painter, InstancedMesh *mesh,
+        const QList<int> &hidden, Layer layer)
+{
+    Item item = newItem(painter, layer, -1);
+    item.instanced = mesh;
+
+    // one pass over the instances, the hidden ids are only a few
+    QSet<int> hiddenIds = hidden.toSet();
+    item.visible = QBitArray(mesh->count());
+    int visible = 0;
+    qreal size = 0;
+    for (int i = 0; i < mesh->count(); ++i) {
+        if (hiddenIds.contains(mesh->id(i))) continue;
+        if (layer == Scene) {
+            painter->modelViewMatrix().push();
+            painter->modelViewMatrix() *= mesh->transform(i);
+            bool culled = isCulled(painter, mesh->bounds());
+            if (!culled) size = qMax(size, projectedSize(painter, mesh->bounds()));
+            painter->modelViewMatrix().pop();
+            if (culled) continue;
+        }
+        item.visible.setBit(i);
+        ++visible;
+    }
+    if (visible == 0) return;
+
+    // all instances share the level of the largest one
+    if (layer == Scene) item.level = MeshLod::levelForSize(size);
+
+    items.append(item);
+}
+
+bool RenderQueue::isCulled(QGLPainter *painter, const QBox3D &box)
+{
+    // an empty box may be a node still loading
+    if (box.isNull()) return false;
+
+    ++testedCount;
+    if (painter->isCullable(box) || (!clipRect.isNull() && isOutsideClipRect(painter, box))) {
+        ++culledCount;
+        return true;
+    }
+    return false;
+}
+
+bool RenderQueue::isOutsideClipRect(QGLPainter *painter, const QBox3D &box) const
+{
+    QRectF rect;
+    if (!projectBox(painter->combinedMatrix(), box, &rect)) return false;
+
+    return rect.right() < clipRect.left() || rect.left() > clipRect.right()
+        || rect.bottom() < clipRect.top() || rect.top() > clipRect.bottom();
+}
+
+qreal RenderQueue::projectedSize(QGLPainter *painter, const QBox3D &box)
+{
+    QRectF rect;
+    // as large as possible when the eye is inside or near
+    if (!projectBox(painter->combinedMatrix(), box, &rect)) return 1e9;
+
+    QRect viewport = painter->currentSurface()->viewportGL();
+    return qMax(rect.width() * viewport.width(), rect.height() * viewport.height()) * 0.5;
+}
+
+void RenderQueue::flush(QGLPainter *painter, bool depthOnly)
+{
+    std::stable_sort(items.begin(), items.end(), lessThan);
+
+    bool picking = painter->isPicking();
+
+    QGLAbstractEffect *prevUserEffect = painter->userEffect();
+    QGL::StandardEffect prevStandardEffect = painter->standardEffect();
+    int prevObjectId = painter->objectPickId();
+    QColor prevColor = painter->color();
+    painter->modelViewMatrix().push();
+    painter->projectionMatrix().push();
+
+    // current state, effect is unknown at first
+    bool effectKnown = false;
+    QGLAbstractEffect *userEffect = NULL;
+    QGL::StandardEffect effect = QGL::FlatColor;
+    QGLMaterial *material = NULL;
+    QGLTexture2D *texture = NULL;
+    int layer = Scene;
+
+    if (depthOnly) glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+    for (const Item &item : items) {
+        if (item.layer != layer) {
+            layer = item.layer;
+            if (layer == Overlay) {
+                glClear(GL_DEPTH_BUFFER_BIT);
+                glEnable(GL_BLEND);
+            }
+        }
+
+        painter->modelViewMatrix() = item.modelView;
+        painter->projectionMatrix() = item.projection;
+        if (item.color != painter->color())
+            painter->setColor(item.color);
+
+        if (item.instanced) {
+            // draws with its own effects and materials
+            if (material) material->release(painter, NULL);
+            material = NULL;
+            texture = NULL;
+            item.instanced->draw(painter, item.visible, item.level);
+            effectKnown = false;
+            ++drawCount;
+            ++instancedDraws;
+            instanceCount += item.visible.count(true);
+            continue;
+        }
+
+        const MeshPart &part = item.part;
+
+        if (depthOnly) {
+            if (!effectKnown) {
+                painter->setStandardEffect(QGL::FlatColor);
+                effectKnown = true;
+                ++effectChanges;
+            }
+        } else if (!effectKnown || part.userEffect != userEffect
+                || (!userEffect && part.effect != effect)) {
+            if (part.userEffect)
+                painter->setUserEffect(part.userEffect);
+            else
+                painter->setStandardEffect(part.effect);
+            effectKnown = true;
+            userEffect = part.userEffect;
+            effect = part.effect;
+            ++effectChanges;
+        }
+
+        if (!picking && !depthOnly && part.material != material) {
+            if (material) material->release(painter, part.material);
+            if (part.material) part.material->bind(painter);
+            QGLTexture2D *newTexture = part.material ? part.material->texture() : NULL;
+            if (newTexture != texture) ++textureChanges;
+            material = part.material;
+            texture = newTexture;
+            ++materialChanges;
+        }
+
+        painter->setObjectPickId(item.id);
+        if (picking && hoveringId != -1 && hoveringId == item.id)
+            hoveringPickColor = painter->pickColor();
+
+        QGeometryData geometry = part.geometry;
+        geometry.draw(painter, part.start, part.count, part.mode);
+        ++drawCount;
+    }
+
+    if (material) material->release(painter, NULL);
+    if (layer == Overlay) glDisable(GL_BLEND);
+    if (depthOnly) glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    painter->modelViewMatrix().pop();
+    painter->projectionMatrix().pop();
+    painter->setColor(prevColor);
+    painter->setObjectPickId(prevObjectId);
+    if (prevUserEffect)
+        painter->setUserEffect(prevUserEffect);
+    else
+        painter->setStandardEffect(prevStandardEffect);
+
+    items.clear();
+}
+
+void RenderQueue::resetStats()
+{
+    drawCount = 0;
+    instancedDraws = instanceCount = 0;
+    culledCount = testedCount = 0;
+    effectChanges = textureChanges = materialChanges = 0;
+}
+
+QString RenderQueue::stats() const
+{
+    return QString("%1 draws (%2 instanced, of %3 instances), "
+                   "%4 state changes (%5 effects, %6 textures, %7 materials), "
+                   "%8 of %9 items culled")
+        .arg(drawCount).arg(instancedDraws).arg(instanceCount).arg(stateChanges())
+        .arg(effectChanges).arg(textureChanges).arg(materialChanges)
+        .arg(culledCount).arg(testedCount);
+}
+
+RenderQueue::Item RenderQueue::newItem(QGLPainter *painter, Layer layer, int id)
+{
+    Item item;
+    item.layer = layer;
+    item.instanced = NULL;
+    item.level = 0;
+    item.modelView = painter->modelViewMatrix().top();
+    item.projection = painter->projectionMatrix().top();
+    item.color = painter->color();
+    item.id = id;
+    return item;
+}
+
+/* Scene items by effect, texture and material; overlay items keep order */
+bool RenderQueue::lessThan(const Item &a, const Item &b)
+{
+    if (a.layer != b.layer) return a.layer < b.layer;
+    if (a.layer == Overlay) return false;
+
+    // instanced meshes set up their own state, draw them last
+    if ((a.instanced != NULL) != (b.instanced != NULL)) return b.instanced != NULL;
+    if (a.instanced) return false;
+
+    const MeshPart &p = a.part, &q = b.part;
+    if (p.userEffect != q.userEffect) return p.userEffect < q.userEffect;
+    if (!p.userEffect && p.effect != q.effect) return p.effect < q.effect;
+
+    QGLTexture2D *pt = p.material ? p.material->texture() : NULL;
+    QGLTexture2D *qt = q.material ? q.material->texture() : NULL;
+    if (pt != qt) return pt < qt;
+    return p.material < q.material;
+}
@@ -0,0 +1,101 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include "geometryutil.h"
+#include <Qt3D/QBox3D>
+#include <QtCore/QBitArray>
+#include <QtCore/QRectF>
+#include <QtGui/QColor>
+
+class InstancedMesh;
+class QGLPainter;
+
+/**
+ * \brief Draw items collected from scene nodes, submitted in state order
+ *
+ * Scene nodes are flattened to parts when added, keeping the model-view
+ * and projection matrices, color and pick id at that moment. Parts without
+ * an effect of their own get the effect of the painter when added, so that
+ * the effect set by one node no longer leaks into the nodes drawn after it.
+ *
+ * On flush, items of the scene layer are sorted by effect, then texture,
+ * then material, and drawn with an effect or material only set when it
+ * differs from the previous item. Items of the overlay layer are drawn
+ * after the scene in the order they are added, with the depth buffer
+ * cleared and blending enabled.
+ *
+ * Scene nodes and instances out of the view frustum are skipped when
+ * added, tested with the bounding box of the node (cached by Qt3D).
+ * A clip rect narrows the test to part of the screen. The same box
+ * projected on screen selects the level of detail (see MeshLod).
+ *
+ * Lights are not part of the items, so items painted under different
+ * lights must be flushed separately.
+ */
+
+class RenderQueue {
+public:
+    enum Layer { Scene, Overlay };
+
+    /// Queue @p node and its children as they would be drawn by @p painter
+    /// now, with pick id @p id.
+    void add(QGLPainter *painter, QGLSceneNode *node, int id = -1, Layer layer = Scene);
+
+    /// Queue all instances of @p mesh except the @p hidden ids
+    /// and those out of view.
+    void add(QGLPainter *painter, InstancedMesh *mesh,
+            const QList<int> &hidden = QList<int>(), Layer layer = Scene);
+
+    /// Return true if @p box under current matrices of @p painter
+    /// is out of view, counted in statistics.
+    bool isCulled(QGLPainter *painter, const QBox3D &box);
+
+    /// Also cull items outside @p rect in normalized device coordinates,
+    /// typically the screen area of a portal. A null rect disables it.
+    inline void setClipRect(const QRectF &rect) { clipRect = rect; }
+
+    /// Return the size in pixels of @p box projected by @p painter,
+    /// or a huge value if the box is around the eye.
+    static qreal projectedSize(QGLPainter *painter, const QBox3D &box);
+
+    /// Sort and draw queued items with @p painter, then clear the queue.
+    /// If @p depthOnly is true, only the depth buffer is written, with the
+    /// simplest effect and no material.
+    void flush(QGLPainter *painter, bool depthOnly = false);
+
+    /// Reset the counters, typically at start of a frame.
+    void resetStats();
+
+    /// Return the number of effect, texture and material changes since
+    /// last resetStats().
+    inline int stateChanges() const { return effectChanges + textureChanges + materialChanges; }
+
+    /// Return a human-readable summary of the counters.
+    QString stats() const;
+
+private:
+    struct Item {
+        Layer layer;
+        MeshPart part;
+        InstancedMesh *instanced;
+        QBitArray visible;  // by instance
+        int level;
+        QMatrix4x4 modelView, projection;
+        QColor color;
+        int id;
+    };
+
+    bool isOutsideClipRect(QGLPainter *painter, const QBox3D &box) const;
+    Item newItem(QGLPainter *painter, Layer layer, int id);
+    static bool lessThan(const Item &a, const Item &b);
+
+    QList<Item> items;
+    QRectF clipRect;
+
+    int drawCount = 0;
+    int instancedDraws = 0, instanceCount = 0;
+    int culledCount = 0, testedCount = 0;
+    int effectChanges = 0, textureChanges = 0, materialChanges = 0;
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include "resourcemanager.h"
+#include "meshlod.h"
+#include <Qt3D/QGLAbstractScene>
+#include <Qt3D/QGLSceneNode>
+#include <Qt3D/QGLTexture2D>
+#include <QtGui/QImage>
+
+#include <QtCore/QDebug>
+
+ResourceManager resources;
+
+ResourceManager::ResourceManager() : budget(256 * 1024 * 1024) { }
+
+QGLTexture2D *ResourceManager::acquireTexture(const QString &fileName)
+{
+    if (entries.contains(fileName)) {
+        Entry &entry = entries[fileName];
+        acquire(entry);
+        return entry.texture;
+    }
+
+    return acquireTexture(fileName, QImage(fileName));
+}
+
+QGLTexture2D *ResourceManager::acquireTexture(const QString &key, const QImage &image)
+{
+    if (!entries.contains(key)) {
+        Entry &entry = insert(key);
+        entry.texture = new QGLTexture2D();
+        keys.insert(entry.texture, key);
+    }
+
+    Entry &entry = entries[key];
+    resident -= entry.bytes;
+    entry.texture->setImage(image);
+    entry.bytes = textureBytes(image);
+    resident += entry.bytes;
+
+    acquire(entry);
+    QGLTexture2D *tex = entry.texture;
+    evict();
+    return tex;
+}
+
+void ResourceManager::releaseTexture(QGLTexture2D *tex)
+{
+    if (tex) release(keys.value(tex));
+}
+
+QGLSceneNode *ResourceManager::acquireMesh(const QString &fileName, QGLAbstractScene *scene)
+{
+    ++generation;
+    if (entries.contains(fileName)) {
+        Entry &entry = entries[fileName];
+        acquire(entry);
+        if (scene && scene != entry.scene)
+            delete scene;
+        return entry.mesh;
+    }
+
+    if (!scene) {
+        scene = QGLAbstractScene::loadScene(fileName);
+        if (!scene) {
+            qDebug() << "Failed to load model" << fileName;
+            return NULL;
+        }
+        MeshLod::generate(scene->mainNode());
+    }
+
+    Entry &entry = insert(fileName);
+    entry.scene = scene;
+    entry.mesh = scene->mainNode();
+    entry.bytes = meshBytes(entry.mesh);
+    meshResident += entry.bytes;
+
+    acquire(entry);
+    return entry.mesh;
+}
+
+void ResourceManager::setBudget(qint64 bytes)
+{
+    budget = bytes;
+    overBudgetWarned = false;
+    evict();
+}
+
+QString ResourceManager::residency() const
+{
+    int textures = 0, meshes = 0, unused = 0;
+    qint64 usedBytes = 0;
+
+    for (const Entry &entry : entries) {
+        if (!entry.texture) {
+            ++meshes;
+            continue;
+        }
+        ++textures;
+        if (entry.refs > 0) usedBytes += entry.bytes; else ++unused;
+    }
+
+    return QString("%1 textures (%2 unused), %3 KB in use, %4 KB cached, budget %5 KB; "
+                   "%6 meshes, %7 KB")
+        .arg(textures).arg(unused)
+        .arg(usedBytes / 1024).arg((resident - usedBytes) / 1024).arg(budget / 1024)
+        .arg(meshes).arg(meshResident / 1024);
+}
+
+ResourceManager::Entry &ResourceManager::insert(const QString &key)
+{
+    Entry &entry = entries[key];
+    entry = Entry{NULL, NULL, NULL, 0, 0, 0};
+    return entry;
+}
+
+void ResourceManager::acquire(Entry &entry)
+{
+    ++entry.refs;
+    entry.lastUse = ++useCounter;
+}
+
+void ResourceManager::release(const QString &key)
+{
+    auto it = entries.find(key);
+    if (it == entries.end()) return;
+
+    Q_ASSERT(it->refs > 0);
+    --it->refs;
+    it->lastUse = ++useCounter;
+    evict();
+}
+
+void ResourceManager::evict()
+{
+    while (resident > budget) {
+        // least recently used among unused textures
+        auto victim = entries.end();
+        for (auto it = entries.begin(); it != entries.end(); ++it)
+            if (it->texture && it->refs == 0
+                    && (victim == entries.end() || it->lastUse < victim->lastUse))
+                victim = it;
+
+        if (victim == entries.end()) {
+            if (!overBudgetWarned)
+                qDebug() << "Resources in use exceed budget:" << residency();
+            overBudgetWarned = true;
+            return;
+        }
+
+        destroy(*victim);
+        entries.erase(victim);
+    }
+    overBudgetWarned = false;
+}
+
+void ResourceManager::destroy(Entry &entry)
+{
+    resident -= entry.bytes;
+    keys.remove(entry.texture);
+    // GL resource is freed by processPendingResourceDeallocations()
+    entry.texture->release();
+    entry.texture->deleteLater();
+}
+
+qint64 ResourceManager::textureBytes(const QImage &image)
+{
+    // RGBA texels plus a third for mipmaps
+    return qint64(image.width()) * image.height() * 4 * 4 / 3;
+}
+
+qint64 ResourceManager::meshBytes(QGLSceneNode *mesh)
+{
+    // nodes of a mesh share one vertex buffer, estimate it by index count
+    qint64 bytes = 0;
+    QList<QGLSceneNode*> nodes = mesh->allChildren();
+    nodes.append(mesh);
+    for (QGLSceneNode *node : nodes)
+        bytes += qint64(node->count()) * (4 + 32);
+    return bytes;
+}
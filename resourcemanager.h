@@ -0,0 +1,95 @@
+#ifndef RESOURCEMANAGER_H
+#define RESOURCEMANAGER_H
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+class QGLAbstractScene;
+class QGLSceneNode;
+class QGLTexture2D;
+class QImage;
+
+/**
+ * \brief Owner of all textures and meshes loaded from files
+ *
+ * Resources are identified by a key, normally the file name, so that a file
+ * used in several places is only loaded once. Every user acquires a texture
+ * and releases it when done; the texture stays cached after the last
+ * release, until it is evicted.
+ *
+ * Meshes are the models of main.conf, shared by all rooms for the life of
+ * the process, so they are never released nor evicted and the budget
+ * covers textures only. The size of textures is estimated as 4 bytes per
+ * texel plus mipmaps. When the total exceeds the budget, unused textures
+ * are evicted, least recently used first. Textures in use are never
+ * evicted, so the budget may be exceeded if they alone are too large.
+ *
+ * Resources must be acquired and released in the main thread.
+ */
+
+class ResourceManager {
+public:
+    ResourceManager();
+
+    /// Return the texture loaded from @p fileName, load it if not cached.
+    QGLTexture2D *acquireTexture(const QString &fileName);
+
+    /// Return the texture identified by @p key with content @p image.
+    /// If the key is cached, the image of the texture is replaced,
+    /// this is used for decoded images and generated contents.
+    QGLTexture2D *acquireTexture(const QString &key, const QImage &image);
+
+    /// Release a texture acquired before. Do nothing for NULL.
+    void releaseTexture(QGLTexture2D *tex);
+
+    /// Return the mesh loaded from @p fileName, kept until exit.
+    /// If it is not cached, take the main node of @p scene, or load the file
+    /// if @p scene is NULL. The manager takes ownership of @p scene.
+    QGLSceneNode *acquireMesh(const QString &fileName, QGLAbstractScene *scene = NULL);
+
+    /// Return a number that changes whenever a mesh is acquired,
+    /// for users caching data derived from meshes.
+    inline int meshGeneration() const { return generation; }
+
+    /// Set the memory budget of textures in bytes, evict them if exceeded.
+    void setBudget(qint64 bytes);
+
+    /// Return the estimated memory of cached textures in bytes.
+    inline qint64 residentBytes() const { return resident; }
+
+    /// Return a human-readable summary of cached resources.
+    QString residency() const;
+
+private:
+    struct Entry {
+        QGLTexture2D *texture;
+        QGLAbstractScene *scene;
+        QGLSceneNode *mesh;
+        int refs;
+        qint64 bytes;
+        qint64 lastUse;
+    };
+
+    Entry &insert(const QString &key);
+    void acquire(Entry &entry);
+    void release(const QString &key);
+    void evict();
+    void destroy(Entry &entry);
+
+    static qint64 textureBytes(const QImage &image);
+    static qint64 meshBytes(QGLSceneNode *mesh);
+
+    QHash<QString, Entry> entries;
+    QHash<const void*, QString> keys;
+
+    qint64 budget;
+    qint64 resident = 0;        // textures only
+    qint64 meshResident = 0;
+    qint64 useCounter = 0;
+    int generation = 0;
+    bool overBudgetWarned = false;
+};
+
+extern ResourceManager resources;
+
+#endif
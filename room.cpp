@@ -1,31 +1,80 @@
 #include "room.h"
 #include "common.h"
 #include "directory.h"
+#include "geometryutil.h"
 #include "imageviewer.h"
+#include "instancedmesh.h"
+#include "meshlod.h"
+#include "raypicker.h"
+#include "renderqueue.h"
+#include "resourcemanager.h"
+#include "trace.h"
 #include <Qt3D/QGLPainter>
-#include <Qt3D/QGLAbstractScene>
 #include <Qt3D/QGLBuilder>
+#include <Qt3D/QGLCube>
+
+QGLSceneNode *Room::placeholder = NULL;
 
 inline QVector3D rotateCcw(qreal x, qreal y, qreal z, qreal angle)
 {
     return QQuaternion::fromAxisAndAngle(0, 1, 0, angle).rotatedVector(QVector3D(x, y, z));
 }
 
-Room::Room(const QString &fileName)
+/* Sections rebuilt as a whole on reload, in this order */
+static const char *SectionNames[] = { "model", "wall", "cdup", "material", "entryModel", "slot" };
+
+/* Labels of entries: the center in the space of a slot, in front of the
+ * bottom of the entry, then the height of letters and the widest label */
+static const QVector3D LabelPos(0, 1, 6);
+static const qreal LabelHeight = 1.6;
+static const qreal LabelWidth = 11;
+
+Room::Room(const QString &fileName) : fileName(fileName)
 {
     setFloorAndCeil();
 
-    entryModel.resize(typeNameList.size() + 2);
-    // set default model
-    for (int i = 2; i < entryModel.size(); ++i)
-        if (entryModel.at(i) == NULL)
-            entryModel[i] = entryModel.at(1);
+    /* Drawn in place of entry models that are still loading */
+    if (!placeholder) {
+        QGLBuilder builder;
+        builder.newSection(QGL::Faceted);
+        builder << QGLCube(1);
+        placeholder = builder.finalizedSceneNode();
+        QMatrix4x4 boxTrans;
+        boxTrans.translate(0, 3, 0);
+        boxTrans.scale(6, 6, 4);
+        placeholder->setLocalTransform(boxTrans);
+        placeholder->setMaterial(new QGLMaterial());
+        placeholder->setEffect(QGL::LitMaterial);
+    }
+
+    sections = parseConfig(fileName);
+    for (const char *name : SectionNames)
+        loadSection(name);
+}
+
+QStringList Room::reload()
+{
+    QHash<QString, Section> newSections = parseConfig(fileName);
+    QStringList changed;
+
+    for (const char *name : SectionNames) {
+        if (newSections.value(name) == sections.value(name)) continue;
+        sections[name] = newSections.value(name);
+        loadSection(name);
+        changed << name;
+    }
+
+    return changed;
+}
+
+QHash<QString, Room::Section> Room::parseConfig(const QString &fileName)
+{
+    TraceSpan span("parse " + fileName);
+    QHash<QString, Section> result;
 
     QFile file(configDir + fileName);
     file.open(QIODevice::ReadOnly);
     QString line, property;
-    QTextStream stream;
-    stream.setString(&line, QIODevice::ReadOnly);
 
     while (!file.atEnd()) {
         line = file.readLine();
@@ -33,103 +82,345 @@ Room::Room(const QString &fileName)
         if (line[0] == '[') {
             property = line.mid(1, line.indexOf(']') - 1);
         } else {
-            stream.seek(0);
-            loadProperty(property, stream);
+            // slot groups and generators only make sense together with their slots
+            QString section = property.startsWith("slot") ? "slot" : property;
+            result[section].append(qMakePair(property, line));
         }
     }
 
     file.close();
+    return result;
+}
 
-    /* Arrows, temporary solution */
-    QGLAbstractScene *model;
+void Room::loadSection(const QString &name)
+{
+    ++loadCount;
+
+    // clear members built by this section
+    if (name == "model") {
+        for (const MeshInfo &obj : solid)
+            delete obj.anim;
+        solid.clear();
+        staticDirty = true;
+    } else if (name == "wall") {
+        for (const MeshInfo &obj : wall)
+            delete obj.mesh;
+        wall.clear();
+        doorPortal.clear();
+        staticDirty = true;
+    } else if (name == "entryModel") {
+        entryModel.fill(NULL, typeNameList.size() + 2);
+        frontBatches.dirty = backBatches.dirty = true;
+        sideBatches[0].dirty = sideBatches[1].dirty = true;
+    } else if (name == "slot") {
+        slot.clear();
+        slotBase.setToIdentity();
+        frontBatches.dirty = backBatches.dirty = true;
+        sideBatches[0].dirty = sideBatches[1].dirty = true;
+        frontBatches.labelsDirty = backBatches.labelsDirty = true;
+        sideBatches[0].labelsDirty = sideBatches[1].labelsDirty = true;
+    }
 
-    model = QGLAbstractScene::loadScene(dataDir + QString("leftarrow.obj"));
-    model->mainNode()->setMaterial(palette["tmp2"]);
-    QMatrix4x4 trans;
-    trans.translate(-50, 90, -roomLength / 2);
-    trans.scale(0.4);
-    solid.append(MeshInfo{model->mainNode(), trans, LeftArrow, NULL});
+    QString line;
+    QTextStream stream;
+    stream.setString(&line, QIODevice::ReadOnly);
+    for (const QPair<QString, QString> &item : sections.value(name)) {
+        line = item.second;
+        stream.seek(0);
+        loadProperty(item.first, stream);
+    }
 
-    model = QGLAbstractScene::loadScene(dataDir + QString("rightarrow.obj"));
-    model->mainNode()->setMaterial(palette["tmp2"]);
-    trans.setToIdentity();
-    trans.translate(50, 90, -roomLength / 2);
-    trans.scale(0.4);
-    solid.append(MeshInfo{model->mainNode(), trans, RightArrow, NULL});
+    if (name == "model") {
+        /* Arrows, temporary solution */
+        models["leftarrow"]->setMaterial(palette["tmp2"]);
+        QMatrix4x4 trans;
+        trans.translate(-50, 90, -roomLength / 2);
+        trans.scale(0.4);
+        solid.append(MeshInfo{models["leftarrow"], trans, LeftArrow, NULL});
+
+        models["rightarrow"]->setMaterial(palette["tmp2"]);
+        trans.setToIdentity();
+        trans.translate(50, 90, -roomLength / 2);
+        trans.scale(0.4);
+        solid.append(MeshInfo{models["rightarrow"], trans, RightArrow, NULL});
+
+    } else if (name == "entryModel") {
+        // set default model
+        for (int i = 2; i < entryModel.size(); ++i)
+            if (entryModel.at(i) == NULL)
+                entryModel[i] = entryModel.at(1);
+    }
 }
 
 void Room::paintFront(QGLPainter *painter, int animObj, qreal animProg) const
+{
+    RenderQueue queue;
+    queueFront(&queue, painter, animObj, animProg);
+    queue.flush(painter);
+}
+
+void Room::queueFront(RenderQueue *queue, QGLPainter *painter, int animObj, qreal animProg,
+        bool shell) const
 {
     // paint solid models
+    painter->setColor(QColor(Qt::white));
+    for (const MeshInfo &obj : solid)
+        if (!obj.isStatic())
+            obj.queue(queue, painter, animObj != -1 && obj.id == animObj ? animProg : 0.0);
+
+    if (shell) queueShell(queue, painter);
+
+    // paint entries
+    if (pageSlide == 0.0) {
+        queueEntries(queue, painter, frontPage, frontBatches, pickedEntry, animObj, animProg);
+    } else {
+        // the page turned from goes out the other side
+        QVector3D step = pageStep();
+        int from = pageSlide > 0 ? 0 : 1;
+        qreal fromSlide = pageSlide > 0 ? pageSlide - 1 : pageSlide + 1;
+
+        painter->modelViewMatrix().push();
+        painter->modelViewMatrix().translate(step * pageSlide);
+        queueEntries(queue, painter, frontPage, frontBatches, pickedEntry);
+        painter->modelViewMatrix().pop();
+
+        painter->modelViewMatrix().push();
+        painter->modelViewMatrix().translate(step * fromSlide);
+        queueEntries(queue, painter, sidePage[from], sideBatches[from]);
+        painter->modelViewMatrix().pop();
+    }
+
+    frontImage->queue(queue, painter);
+}
+
+void Room::addToPicker(RayPicker *picker) const
+{
+    // solid models, static ones and walls only hide what is behind
     for (const MeshInfo &obj : solid) {
-        painter->setColor(QColor(Qt::white));
-        obj.draw(painter, animObj != -1 && obj.id == animObj ? animProg : 0.0);
+        picker->add(obj.mesh, obj.transform, obj.id);
+        if (obj.anim)
+            picker->add(obj.anim->mesh, obj.transform, obj.id);
+    }
+    for (const MeshInfo &obj : wall)
+        picker->add(obj.mesh, obj.transform);
+
+    picker->add(floor, QMatrix4x4());
+    picker->add(ceil, QMatrix4x4());
+
+    // entries except the picked one, directories with the closed lid
+    for (int i = 0; i < frontPage.size(); ++i) {
+        if (i == pickedEntry) continue;
+        picker->add(entryMesh(frontPage[i]), slot[i], i);
+        if (frontPage[i] == 0)
+            picker->add(dirAnim.mesh, slot[i], i);
     }
 
-    // paint floor and ceil
-    floor->draw(painter);
-    // walkaround for material issue
-    painter->setStandardEffect(QGL::LitMaterial);
-    ceil->draw(painter);
+    frontImage->addToPicker(picker);
+}
 
-    // paint entries
-    for (int i = 0; i < frontPage.size(); ++i)
-        if (i != pickedEntry)
-            paintMesh(painter,
-                    entryModel[frontPage[i]], slot[i], i,
-                    frontPage[i] == 0 ? &dirAnim : NULL,
-                    i == animObj ? animProg : 0.0);
+void Room::queueShell(RenderQueue *queue, QGLPainter *painter) const
+{
+    painter->setColor(QColor(Qt::white));
+    queueStatic(queue, painter);
 
-    frontImage->draw(painter);
+    // paint floor and ceil
+    queue->add(painter, floor);
+    queue->add(painter, ceil);
 }
 
-void Room::paintBack(QGLPainter *painter, AnimStage stage) const
+void Room::queueBack(RenderQueue *queue, QGLPainter *painter, AnimStage stage) const
 {
+    // the whole room may be out of view
+    if (queue->isCulled(painter, bounds())) return;
+
     // paint solid models
     for (const MeshInfo &obj : solid)
-        obj.draw(painter);
+        if (!obj.isStatic())
+            obj.queue(queue, painter);
+    queueStatic(queue, painter);
 
     // paint floor and ceil
     if (stage == Entering1 || stage == Entering2) {
         /* Move floor a little bit upper to cover outside items */
         painter->modelViewMatrix().push();
         painter->modelViewMatrix().translate(0, 0.001, 0);
-        floor->draw(painter);
+        queue->add(painter, floor);
         painter->modelViewMatrix().pop();
     } else {
-        floor->draw(painter);
-        // walkaround for material issue
-        painter->setStandardEffect(QGL::LitMaterial);
-        ceil->draw(painter);
+        queue->add(painter, floor);
+        queue->add(painter, ceil);
     }
 
     // paint entires
     if (stage != Leaving1 && stage != Leaving2)
-        for (int i = 0; i < backPage.size(); ++i)
-            paintMesh(painter,
-                    entryModel[backPage[i]], slot[i], i,
-                    backPage[i] == 0 ? &dirAnim : NULL);
+        queueEntries(queue, painter, backPage, backBatches);
 
     if (stage != Leaving1)
-        backImage->draw(painter);
+        backImage->queue(queue, painter);
+
+}
+
+void Room::queueStatic(RenderQueue *queue, QGLPainter *painter) const
+{
+    if (staticDirty || staticGeneration != resources.meshGeneration()) {
+        qDeleteAll(staticMesh);
+        staticMesh.fill(NULL, MeshLod::LevelCount + 1);
+        staticDirty = false;
+        staticGeneration = resources.meshGeneration();
+    }
+
+    // the merged mesh loses identity of models, so the level is chosen
+    // for the whole room, mostly useful for rooms seen through a portal
+    int level = MeshLod::levelForSize(RenderQueue::projectedSize(painter, bounds()));
+
+    if (!staticMesh[level]) {
+        TraceSpan span(QString("merge static %1 (level %2)").arg(fileName).arg(level));
 
+        QList<MeshPart> parts;
+        for (const MeshInfo &obj : wall)
+            parts += collectParts(obj.mesh, obj.transform);
+        for (const MeshInfo &obj : solid)
+            if (obj.isStatic())
+                parts += collectParts(obj.mesh, obj.transform);
+        for (MeshPart &part : parts)
+            MeshLod::select(part, level);
+
+        staticMesh[level] = mergeParts(parts);
+    }
+
+    // one node per material, culled separately
+    if (staticMesh[level])
+        for (QGLSceneNode *node : staticMesh[level]->children())
+            queue->add(painter, node);
 }
 
 void Room::loadFront(Directory *dir)
 {
     frontPage = dir->entryTypeList();
+    frontBatches.names = dir->entryNameList();
+    frontBatches.dirty = frontBatches.labelsDirty = true;
     frontImage->setFile(dir->getPlayingFile("image"));
+    loadAdjacent(dir);
+}
+
+void Room::loadAdjacent(Directory *dir)
+{
+    for (int i = 0; i < 2; ++i) {
+        sidePage[i] = dir->adjacentTypeList(i ? 1 : -1);
+        sideBatches[i].names = dir->entryNameList(i ? 1 : -1);
+        sideBatches[i].dirty = sideBatches[i].labelsDirty = true;
+    }
+}
+
+void Room::turnPage(int delta, Directory *dir)
+{
+    // the front page goes to the side it is left behind, the page of the
+    // other side comes to front and the far one is loaded in its place
+    int to = delta > 0 ? 1 : 0;
+    int from = 1 - to;
+    frontPage.swap(sidePage[to]);
+    qSwap(frontBatches, sideBatches[to]);
+    sidePage[to].swap(sidePage[from]);
+    qSwap(sideBatches[to], sideBatches[from]);
+
+    sidePage[to] = dir->adjacentTypeList(delta);
+    sideBatches[to].names = dir->entryNameList(delta);
+    sideBatches[to].dirty = sideBatches[to].labelsDirty = true;
+}
+
+bool Room::prefetchPages(LabelRenderer *labels) const
+{
+    bool instancing = InstancedMesh::isSupported();
+    for (int i = 0; i < 2; ++i) {
+        // without instancing there is nothing to build, entries are drawn one by one
+        if (!instancing)
+            sideBatches[i].dirty = false;
+        else if (sideBatches[i].dirty)
+            buildBatches(sideBatches[i], sidePage[i]);
+        if (sideBatches[i].labelsDirty)
+            layoutLabels(sideBatches[i], labels);
+    }
+
+    // last, so that it stays valid if the atlas had to be cleared; side
+    // pages left out of the atlas then are built again when turned to
+    if (frontBatches.labelsDirty || frontBatches.labels.generation == labels->generation())
+        return false;
+    layoutLabels(frontBatches, labels);
+    return true;
+}
+
+void Room::paintLabels(QGLPainter *painter, LabelRenderer *labels) const
+{
+    auto paintPage = [&](EntryBatches &batches, int hidden) {
+        if (batches.labelsDirty)
+            layoutLabels(batches, labels);
+        else if (batches.labels.generation != labels->generation())
+            return;
+        labels->draw(painter, batches.labels, hidden);
+    };
+
+    if (pageSlide == 0.0) {
+        paintPage(frontBatches, pickedEntry);
+        return;
+    }
+
+    // moved like the entries in queueFront
+    QVector3D step = pageStep();
+    int from = pageSlide > 0 ? 0 : 1;
+    qreal fromSlide = pageSlide > 0 ? pageSlide - 1 : pageSlide + 1;
+
+    painter->modelViewMatrix().push();
+    painter->modelViewMatrix().translate(step * pageSlide);
+    paintPage(frontBatches, pickedEntry);
+    painter->modelViewMatrix().pop();
+
+    painter->modelViewMatrix().push();
+    painter->modelViewMatrix().translate(step * fromSlide);
+    paintPage(sideBatches[from], -1);
+    painter->modelViewMatrix().pop();
+}
+
+void Room::layoutLabels(EntryBatches &batches, LabelRenderer *labels) const
+{
+    QVector<QMatrix4x4> frames;
+    for (int i = 0; i < batches.names.size() && i < slot.size(); ++i) {
+        QMatrix4x4 frame = slot[i];
+        frame.translate(LabelPos);
+        frames << frame;
+    }
+    labels->build(batches.labels, batches.names, frames, LabelHeight, LabelWidth);
+    batches.labelsDirty = false;
+}
+
+/* Offset from a page to the next one: the extent of the slots along the
+ * x axis of the first slot, and a gap of a tenth of the room width */
+QVector3D Room::pageStep() const
+{
+    if (slot.isEmpty()) return QVector3D();
+
+    QVector3D origin = slot[0] * QVector3D();
+    QVector3D axis = slot[0].mapVector(QVector3D(1, 0, 0)).normalized();
+    qreal min = 0, max = 0;
+    for (const QMatrix4x4 &mat : slot) {
+        qreal x = QVector3D::dotProduct(mat * QVector3D() - origin, axis);
+        min = qMin(min, x);
+        max = qMax(max, x);
+    }
+    return axis * (max - min + roomWidth * 0.1);
 }
 
 void Room::loadBack(Directory *dir)
 {
     backPage = dir->entryTypeList();
+    backBatches.names = dir->entryNameList();
+    backBatches.dirty = backBatches.labelsDirty = true;
     backImage->setFile(dir->getPlayingFile("image"));
 }
 
 void Room::switchBackAndFront()
 {
     frontPage.swap(backPage);
+    qSwap(frontBatches, backBatches);
     ImageViewer *tmp = frontImage;
     frontImage = backImage;
     backImage = tmp;
@@ -140,13 +431,72 @@ void Room::setImage(const QString &fileName)
     frontImage->setFile(fileName);
 }
 
-void Room::paintPickedEntry(QGLPainter *painter, const QVector3D &delta) const
+void Room::queueEntries(RenderQueue *queue, QGLPainter *painter, const QVector<int> &page,
+        EntryBatches &batches, int hidden, int animObj, qreal animProg) const
+{
+    bool instancing = InstancedMesh::isSupported();
+    if (instancing && batches.dirty)
+        buildBatches(batches, page);
+
+    // entries not in batches: the animated one, those still loading,
+    // or all of them if instancing is unavailable
+    bool animating = animObj >= 0 && animObj < page.size() && animProg != 0.0;
+    for (int i = 0; i < page.size(); ++i) {
+        if (i == hidden) continue;
+        QGLSceneNode *mesh = entryMesh(page[i]);
+        if (!instancing || mesh == placeholder || (animating && i == animObj))
+            queueMesh(queue, painter,
+                    mesh, slot[i], i,
+                    page[i] == 0 ? &dirAnim : NULL,
+                    i == animObj ? animProg : 0.0);
+    }
+
+    if (!instancing) return;
+
+    QList<int> skipped;
+    skipped << hidden;
+    if (animating) skipped << animObj;
+    for (InstancedMesh *mesh : batches.meshes)
+        queue->add(painter, mesh, skipped);
+}
+
+void Room::buildBatches(EntryBatches &batches, const QVector<int> &page) const
+{
+    qDeleteAll(batches.meshes);
+    batches.meshes.clear();
+    batches.dirty = false;
+
+    auto addInstance = [&](QGLSceneNode *mesh, int i) {
+        InstancedMesh *&batch = batches.meshes[mesh];
+        if (!batch) batch = new InstancedMesh(mesh);
+        batch->addInstance(slot[i], i);
+    };
+
+    for (int i = 0; i < page.size(); ++i) {
+        QGLSceneNode *mesh = entryMesh(page[i]);
+        if (mesh == placeholder) {
+            // build again when the model is loaded
+            batches.dirty = true;
+            continue;
+        }
+        addInstance(mesh, i);
+        // closed lid of directories
+        if (page[i] == 0) {
+            if (dirAnim.mesh->children().isEmpty())
+                batches.dirty = true;
+            else
+                addInstance(dirAnim.mesh, i);
+        }
+    }
+}
+
+void Room::queuePickedEntry(RenderQueue *queue, QGLPainter *painter, const QVector3D &delta) const
 {
     QMatrix4x4 trans;
     trans.translate(delta);
     trans *= slot[pickedEntry];
-    paintMesh(painter,
-            entryModel[frontPage[pickedEntry]], trans, -1,
+    queueMesh(queue, painter,
+            entryMesh(frontPage[pickedEntry]), trans, -1,
             frontPage[pickedEntry] == 0 ? &dirAnim : NULL);
 }
 
@@ -155,12 +505,36 @@ QVector3D Room::getSolidPos(int id) const
     for (int i = 0; i < solid.size(); ++i)
         if (solid.at(i).id == id)
             return solid.at(i).transform * QVector3D(0, 0, 0);
+    return QVector3D();
 }
 
-void Room::loadProperty(const QString &property, QTextStream &value)
+QBox3D Room::bounds() const
 {
-    static QMatrix4x4 slotBase;
+    return QBox3D(QVector3D(-roomWidth / 2, 0, -roomLength / 2),
+            QVector3D(roomWidth / 2, roomHeight, roomLength / 2));
+}
+
+QVector<QVector3D> Room::getEntryPortal(int idx) const
+{
+    QBox3D box = entryMesh(0)->boundingBox();
+    QVector3D min = box.minimum(), max = box.maximum();
+
+    QVector<QVector3D> corners;
+    corners << slot[idx] * QVector3D(min.x(), max.y(), min.z())
+            << slot[idx] * QVector3D(max.x(), max.y(), min.z())
+            << slot[idx] * QVector3D(max.x(), max.y(), max.z())
+            << slot[idx] * QVector3D(min.x(), max.y(), max.z());
+    return corners;
+}
 
+QGLSceneNode *Room::entryMesh(int type) const
+{
+    QGLSceneNode *mesh = entryModel.at(type);
+    return mesh->children().isEmpty() ? placeholder : mesh;
+}
+
+void Room::loadProperty(const QString &property, QTextStream &value)
+{
     if (property == "model") {
         loadModel(value);
 
@@ -192,11 +566,48 @@ void Room::loadProperty(const QString &property, QTextStream &value)
     } else if (property == "slot") {
         qreal x, y, z;
         value >> x >> y >> z;
-        slot.append(slotBase);
-        slot.back().translate(x, y, z);
+        addSlot(QVector3D(x, y, z));
+
+    } else if (property == "slotGrid") {
+        // columns x rows on a wall, from the top left
+        int columns, rows;
+        qreal x, y, z, dx, dy, scale;
+        value >> columns >> rows >> x >> y >> z >> dx >> dy >> scale;
+        for (int r = 0; r < rows; ++r)
+            for (int c = 0; c < columns; ++c)
+                addSlot(QVector3D(x + c * dx, y - r * dy, z), 0, scale);
+
+    } else if (property == "slotShelf") {
+        // shelves from the bottom, each with columns x rows from the front left
+        int shelves, columns, rows;
+        qreal x, y, z, dx, dy, dz, scale;
+        value >> shelves >> columns >> rows >> x >> y >> z >> dx >> dy >> dz >> scale;
+        for (int s = 0; s < shelves; ++s)
+            for (int r = 0; r < rows; ++r)
+                for (int c = 0; c < columns; ++c)
+                    addSlot(QVector3D(x + c * dx, y + s * dy, z - r * dz), 0, scale);
+
+    } else if (property == "slotSpiral") {
+        // a helix rising from the bottom, entries facing outwards
+        int count, perTurn;
+        qreal x, y, z, radius, rise, scale;
+        value >> count >> perTurn >> x >> y >> z >> radius >> rise >> scale;
+        for (int i = 0; i < count; ++i) {
+            qreal angle = 360.0 * i / perTurn;
+            addSlot(QVector3D(x, y + rise * i / perTurn, z) + rotateCcw(0, 0, radius, angle),
+                    angle, scale);
+        }
     }
 }
 
+void Room::addSlot(const QVector3D &pos, qreal angle, qreal scale)
+{
+    slot.append(slotBase);
+    slot.back().translate(pos);
+    slot.back().rotate(angle, 0, 1, 0);
+    slot.back().scale(scale);
+}
+
 void Room::loadModel(QTextStream &value)
 {
     QString name, type, anim;
@@ -214,10 +625,12 @@ void Room::loadModel(QTextStream &value)
         id = Image;
 
         // TODO: make the previewer API general
-        frontImage = new ImageViewer(30, 20);
+        // keep the viewers (and their images) when the section is reloaded
+        if (!frontImage) {
+            frontImage = new ImageViewer(30, 20);
+            backImage = new ImageViewer(30, 20);
+        }
         frontImage->setPosition(QVector3D(x, y, z + 1));
-
-        backImage = new ImageViewer(30, 20);
         backImage->setPosition(QVector3D(x, y, z + 1));
 
     } else if (type == "Door") {
@@ -318,7 +731,13 @@ void Room::loadWall(QTextStream &value) {
     trans.translate(rotateCcw(0, 0, -(side & 1 ? roomWidth : roomLength) / 2, side * 90));
     trans.rotate(side * 90, 0, 1, 0);
 
-    solid.append(MeshInfo{mesh, trans, -1, NULL});
+    if (l != -1) {
+        doorPortal.clear();
+        doorPortal << trans * QVector3D(l, 0, 0) << trans * QVector3D(r, 0, 0)
+                   << trans * QVector3D(r, h, 0) << trans * QVector3D(l, h, 0);
+    }
+
+    wall.append(MeshInfo{mesh, trans, -1, NULL});
 }
 
 void Room::setFloorAndCeil() {
@@ -341,43 +760,37 @@ void Room::setFloorAndCeil() {
     ceilBuilder.addPane(QSizeF(roomWidth, roomLength));
     ceilBuilder.currentNode()->setLocalTransform(ceilTrans);
     QGLSceneNode *ceilNode = ceilBuilder.finalizedSceneNode();
+    ceilNode->setEffect(QGL::LitMaterial);
 
     ceil = ceilNode;
 }
 
-void Room::AnimInfo::draw(QGLPainter *painter, qreal animProg) const
+void Room::AnimInfo::queue(RenderQueue *queue, QGLPainter *painter, int id, qreal animProg) const
 {
     if (animProg != 0.0) {
         painter->modelViewMatrix().translate(center);
         painter->modelViewMatrix().rotate(maxAngle * animProg, axis);
         painter->modelViewMatrix().translate(-center);
     }
-    mesh->draw(painter);
+    queue->add(painter, mesh, id);
 }
 
-void Room::MeshInfo::draw(QGLPainter *painter, qreal animProg) const
+void Room::MeshInfo::queue(RenderQueue *queue, QGLPainter *painter, qreal animProg) const
 {
-    paintMesh(painter, mesh, transform, id, anim, animProg);
+    queueMesh(queue, painter, mesh, transform, id, anim, animProg);
 }
 
-void Room::paintMesh(QGLPainter *painter,
+void Room::queueMesh(RenderQueue *queue, QGLPainter *painter,
         QGLSceneNode *mesh, const QMatrix4x4 &trans, int id,
         const AnimInfo *anim, qreal animProg)
 {
     painter->modelViewMatrix().push();
     painter->modelViewMatrix() *= trans;
 
-    int prevObjectId = painter->objectPickId();
-    painter->setObjectPickId(id);
-
-    if (painter->isPicking() && hoveringId != -1 && hoveringId == id)
-        hoveringPickColor = painter->pickColor();
-
-    mesh->draw(painter);
+    queue->add(painter, mesh, id);
 
     if (anim)
-        anim->draw(painter, animProg);
+        anim->queue(queue, painter, id, animProg);
 
     painter->modelViewMatrix().pop();
-    painter->setObjectPickId(prevObjectId);
 }
@@ -1,6 +1,10 @@
 #ifndef ROOM_H
 #define ROOM_H
 
+#include "labelrenderer.h"
+#include <Qt3D/QBox3D>
+#include <QtCore/QHash>
+#include <QtCore/QStringList>
 #include <QtGui/QMatrix4x4>
 
 class QGLPainter;
@@ -8,6 +12,9 @@ class QGLSceneNode;
 class QTextStream;
 class Directory;
 class ImageViewer;
+class InstancedMesh;
+class RayPicker;
+class RenderQueue;
 enum AnimStage : int;
 
 /**
@@ -34,15 +41,39 @@ public:
     /// See examples in config directory for furthur information.
     Room(const QString &fileName);
 
+    /// Return the name of config file.
+    inline QString configFile() const { return fileName; }
+
+    /// Parse the config file again and rebuild sections that changed.
+    /// Loaded models, textures and current entries are kept.
+    /// Return the names of rebuilt sections ("slot" covers "slotGroup").
+    QStringList reload();
+
+    /// Return a number changed whenever a config section is loaded.
+    inline int revision() const { return loadCount; }
+
     /// Paint the room as current one (i.e. the normal room) to painter.
     /// The \p animObj indicates the currently activated animation object,
     /// and \p animProg defines the progress of animation (0.0 ~ 1.0)
     void paintFront(QGLPainter *painter, int animObj = -1, qreal animProg = 0.0) const;
 
-    /// Paint the room as next one to painter (during animation).
+    /// Queue the room as current one, like paintFront.
+    /// The shell (see queueShell) is left out if @p shell is false.
+    void queueFront(RenderQueue *queue, QGLPainter *painter,
+            int animObj = -1, qreal animProg = 0.0, bool shell = true) const;
+
+    /// Add what queueFront draws in picking mode to @p picker,
+    /// with the same ids and no animation.
+    void addToPicker(RayPicker *picker) const;
+
+    /// Queue the parts of the current room that never move:
+    /// walls, static solids, floor and ceil.
+    void queueShell(RenderQueue *queue, QGLPainter *painter) const;
+
+    /// Queue the room as next one (during animation).
     /// The room is painted as it is except adjustment of floor and ceil,
     /// global geometry change should be applied outside.
-    void paintBack(QGLPainter *painter, AnimStage stage) const;
+    void queueBack(RenderQueue *queue, QGLPainter *painter, AnimStage stage) const;
 
     /// Load entries for paintFont from @p dir.
     void loadFront(Directory *dir);
@@ -52,17 +83,59 @@ public:
     /// Push the back entries to front. Typically Called on end of animation.
     void switchBackAndFront();
 
+    /// Load the pages before and after the front one from @p dir.
+    /// Called by loadFront, and again when the front entries changed.
+    void loadAdjacent(Directory *dir);
+
+    /// Move to the page @p delta (1 or -1) pages away, already moved in @p dir.
+    /// The prepared page takes the place of the front one without loading,
+    /// and only the page that becomes adjacent is loaded from @p dir.
+    void turnPage(int delta, Directory *dir);
+
+    /// Return true if the batches or labels of an adjacent page are not
+    /// built yet, or the labels of the front page are from an older atlas
+    /// of @p labels.
+    inline bool hasColdPages(const LabelRenderer *labels) const
+    {
+        return sideBatches[0].dirty || sideBatches[1].dirty
+            || sideBatches[0].labelsDirty || sideBatches[1].labelsDirty
+            || (!frontBatches.labelsDirty
+                && frontBatches.labels.generation != labels->generation());
+    }
+
+    /// Build the batches and labels of adjacent pages, so that turning to
+    /// them costs no more than painting, then the labels of the front page
+    /// again if the atlas was cleared meanwhile. Call it between frames.
+    /// Return true if the front page must be painted again.
+    bool prefetchPages(LabelRenderer *labels) const;
+
+    /// Paint the names of front entries with @p labels, all in one draw,
+    /// over what queueFront painted. Layouts are kept with each page.
+    /// Layouts from an older atlas are left out until prefetchPages()
+    /// builds them again, so a full atlas never stalls a frame.
+    void paintLabels(QGLPainter *painter, LabelRenderer *labels) const;
+
+    /// Slide the front page by @p slide times the width of a page along the
+    /// slots, and show the page it came from beside it (previous one if
+    /// @p slide is positive). Zero shows the front page only.
+    inline void setPageSlide(qreal slide) { pageSlide = slide; }
+
     /// Clear all back entries.
-    inline void clearBack() { backPage.clear(); }
+    inline void clearBack()
+    {
+        backPage.clear();
+        backBatches.names.clear();
+        backBatches.dirty = backBatches.labelsDirty = true;
+    }
 
     /// Pick up an entry.
     /// The picked entry should overlay any other items thus will not be
     /// painted like common entires.
     inline void pickEntry(int index) { pickedEntry = index; }
 
-    /// Paint the picked entry.
+    /// Queue the picked entry.
     /// The position is moved by &deltaPos because of user action.
-    void paintPickedEntry(QGLPainter *painter, const QVector3D &deltaPos) const;
+    void queuePickedEntry(RenderQueue *queue, QGLPainter *painter, const QVector3D &deltaPos) const;
 
     /// Return the max capacity of entries.
     inline int countSlot() const { return slot.size(); }
@@ -77,6 +150,16 @@ public:
     /// Return the direction of door in this room.
     inline qreal getDoorAngle() const { return doorAngle; }
 
+    /// Return the bounding box of the room.
+    QBox3D bounds() const;
+
+    /// Return the corners of the door cut-out in walls,
+    /// or an empty vector if there is no door.
+    inline QVector<QVector3D> getDoorPortal() const { return doorPortal; }
+
+    /// Return the corners of the opening at top of directory entry @p idx.
+    QVector<QVector3D> getEntryPortal(int idx) const;
+
     /// Return the model-view matrix of entry @p idx.
     inline QMatrix4x4 getEntryMat(int idx) const { return slot.at(idx); }
 
@@ -90,12 +173,23 @@ public:
     void setImage(const QString &fileName);
 
 private:
+    // lines of a config section, paired with the property they belong to
+    typedef QList<QPair<QString, QString> > Section;
+
+    static QHash<QString, Section> parseConfig(const QString &fileName);
+    void loadSection(const QString &name);
+
+    QString fileName;
+    QHash<QString, Section> sections;
+    int loadCount = 0;
+
     void loadProperty(const QString &property, QTextStream &value);
 
     // helper functions for loadProperty
     void loadModel(QTextStream &value);
     void loadEntryModel(QTextStream &value);
     void loadWall(QTextStream &value);
+    void addSlot(const QVector3D &pos, qreal angle = 0, qreal scale = 1);
 
     // set up floor and ceil mesh
     void setFloorAndCeil();
@@ -103,33 +197,74 @@ private:
 
     // one-time initialized properties
     QVector3D outPos, doorPos;
+    QVector<QVector3D> doorPortal;
     qreal outAngle, doorAngle;
 
     // variable states
     QVector<int> frontPage, backPage;
     int pickedEntry = -1;
 
+    // pages before and after the front one, prepared for turning
+    QVector<int> sidePage[2];
+    qreal pageSlide = 0.0;
+    QVector3D pageStep() const;
+
     struct AnimInfo {
         QGLSceneNode *mesh; QVector3D center, axis; qreal maxAngle;
-        void draw(QGLPainter *painter, qreal animProg = 0.0) const;
+        void queue(RenderQueue *queue, QGLPainter *painter, int id, qreal animProg = 0.0) const;
     };
 
     struct MeshInfo {
         QGLSceneNode *mesh; QMatrix4x4 transform; int id; AnimInfo *anim;
-        void draw(QGLPainter *painter, qreal animProg = 0.0) const;
+        void queue(RenderQueue *queue, QGLPainter *painter, qreal animProg = 0.0) const;
+        // non-interactive and never moving, merged into staticMesh
+        inline bool isStatic() const { return id == -1 && !anim; }
     };
 
     // room content
     QVector<MeshInfo> solid;
+    QVector<MeshInfo> wall;
     QVector<QMatrix4x4> slot;
+    QMatrix4x4 slotBase;
+
+    // walls and static solids merged by material, one mesh for each level
+    // of detail, built on first use and again after sections reloaded or
+    // models loaded
+    void queueStatic(RenderQueue *queue, QGLPainter *painter) const;
+    mutable QVector<QGLSceneNode*> staticMesh;
+    mutable bool staticDirty = true;
+    mutable int staticGeneration = -1;
 
     // models of various file type
     QVector<QGLSceneNode*> entryModel;
     AnimInfo dirAnim;
 
-    ImageViewer *frontImage, *backImage;
+    // entries of a page grouped by model, each drawn with one instanced call;
+    // rebuilt on first paint after the page, slots or models changed.
+    // The names of the entries are laid out as labels the same way.
+    struct EntryBatches {
+        QHash<QGLSceneNode*, InstancedMesh*> meshes;
+        bool dirty = true;
+        QStringList names;
+        LabelLayout labels;
+        bool labelsDirty = true;
+    };
+    mutable EntryBatches frontBatches, backBatches;
+    mutable EntryBatches sideBatches[2];
+
+    void buildBatches(EntryBatches &batches, const QVector<int> &page) const;
+    void layoutLabels(EntryBatches &batches, LabelRenderer *labels) const;
+    void queueEntries(RenderQueue *queue, QGLPainter *painter, const QVector<int> &page,
+            EntryBatches &batches, int hidden = -1,
+            int animObj = -1, qreal animProg = 0.0) const;
+
+    // return the model of file type, or placeholder if not loaded yet
+    QGLSceneNode *entryMesh(int type) const;
+    static QGLSceneNode *placeholder;
+
+    ImageViewer *frontImage = NULL, *backImage = NULL;
 
-    static void paintMesh(QGLPainter *painter,
+    static void queueMesh(RenderQueue *queue, QGLPainter *painter,
             QGLSceneNode *mesh, const QMatrix4x4 &trans, int id,
             const AnimInfo *anim = NULL, qreal animProg = 0.0);
 };
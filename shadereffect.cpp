@@ -0,0 +1,292 @@
+#include "shadereffect.h"
+#include "common.h"
+#include "trace.h"
+#include <Qt3D/QGLLightParameters>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QStandardPaths>
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLFunctions>
+#include <QtGui/QOpenGLShaderProgram>
+
+#include <QtCore/QDebug>
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+typedef void (QOPENGLF_APIENTRYP ProgramBinaryFunc)(GLuint, GLenum, const void *, GLsizei);
+typedef void (QOPENGLF_APIENTRYP GetProgramBinaryFunc)(GLuint, GLsizei, GLsizei *, GLenum *, void *);
+typedef void (QOPENGLF_APIENTRYP ProgramParameteriFunc)(GLuint, GLenum, GLint);
+
+namespace {
+
+ProgramBinaryFunc programBinary = NULL;
+GetProgramBinaryFunc getProgramBinary = NULL;
+ProgramParameteriFunc programParameteri = NULL;
+
+/* Resolve entry points once, return false if program binaries are unusable */
+bool binarySupported()
+{
+    static int supported = -1;
+    if (supported != -1) return supported;
+
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    QSurfaceFormat format = context->format();
+    supported = context->hasExtension("GL_ARB_get_program_binary")
+        || format.majorVersion() > 4
+        || (format.majorVersion() == 4 && format.minorVersion() >= 1);
+
+    if (supported) {
+        programBinary = (ProgramBinaryFunc)context->getProcAddress("glProgramBinary");
+        getProgramBinary = (GetProgramBinaryFunc)context->getProcAddress("glGetProgramBinary");
+        programParameteri = (ProgramParameteriFunc)context->getProcAddress("glProgramParameteri");
+        supported = programBinary && getProgramBinary && programParameteri;
+    }
+
+    if (supported) {
+        // a driver may expose the API without any format
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        supported = formats > 0;
+    }
+
+    return supported;
+}
+
+QString cacheDir()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/shaders/";
+}
+
+QByteArray driverString()
+{
+    QByteArray str;
+    str += reinterpret_cast<const char *>(glGetString(GL_VENDOR));
+    str += '\0';
+    str += reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+    str += '\0';
+    str += reinterpret_cast<const char *>(glGetString(GL_VERSION));
+    return str;
+}
+
+QByteArray readFile(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "Failed to read shader" << fileName;
+        return QByteArray();
+    }
+    return file.readAll();
+}
+
+/* Standard attributes and the index QGLPainter uses for them */
+const struct { const char *name; QGL::VertexAttribute attr; } Attributes[] = {
+    { "qt_Vertex", QGL::Position },
+    { "qt_Normal", QGL::Normal },
+    { "qt_Color", QGL::Color },
+    { "qt_MultiTexCoord0", QGL::TextureCoord0 },
+    { "qt_MultiTexCoord1", QGL::TextureCoord1 },
+    { "qt_MultiTexCoord2", QGL::TextureCoord2 },
+    { "qt_Custom0", QGL::CustomVertex0 },
+    { "qt_Custom1", QGL::CustomVertex1 }
+};
+
+}
+
+ShaderEffect::ShaderEffect() { }
+
+ShaderEffect::~ShaderEffect()
+{
+    delete prog;
+}
+
+void ShaderEffect::setVertexShaderFromFile(const QString &fileName)
+{
+    vertexSource = readFile(fileName);
+    name = QFileInfo(fileName).baseName();
+}
+
+void ShaderEffect::setFragmentShaderFromFile(const QString &fileName)
+{
+    fragmentSource = readFile(fileName);
+    QString fragName = QFileInfo(fileName).baseName();
+    if (fragName != name)
+        name += "/" + fragName;
+}
+
+void ShaderEffect::bindAttributeLocation(const QByteArray &name, int location)
+{
+    extraAttributes.append(qMakePair(name, location));
+}
+
+void ShaderEffect::setActive(QGLPainter *painter, bool flag)
+{
+    Q_UNUSED(painter);
+
+    if (!prog) {
+        if (!flag) return;
+        createProgram();
+    }
+
+    if (flag) {
+        prog->bind();
+        for (int attr : attributes)
+            prog->enableAttributeArray(attr);
+    } else {
+        for (int attr : attributes)
+            prog->disableAttributeArray(attr);
+        prog->release();
+    }
+}
+
+void ShaderEffect::update(QGLPainter *painter, QGLPainter::Updates updates)
+{
+    if ((updates & QGLPainter::UpdateMatrices) != 0) {
+        if (mvpLocation != -1)
+            prog->setUniformValue(mvpLocation, painter->combinedMatrix());
+        if (modelViewLocation != -1)
+            prog->setUniformValue(modelViewLocation, painter->modelViewMatrix().top());
+        if (projectionLocation != -1)
+            prog->setUniformValue(projectionLocation, painter->projectionMatrix().top());
+        if (normalMatrixLocation != -1)
+            prog->setUniformValue(normalMatrixLocation, painter->normalMatrix());
+    }
+
+    if ((updates & (QGLPainter::UpdateLights | QGLPainter::UpdateModelViewMatrix)) != 0
+            && lightLocation != -1)
+        prog->setUniformValue(lightLocation,
+                painter->mainLight()->eyePosition(painter->mainLightTransform()));
+
+    if ((updates & QGLPainter::UpdateColor) != 0 && colorLocation != -1)
+        prog->setUniformValue(colorLocation, painter->color());
+}
+
+void ShaderEffect::createProgram()
+{
+    qint64 begin = startupTimer.nsecsElapsed();
+    QString state;
+
+    if (binarySupported()) {
+        // attribute locations are part of the linked program
+        QByteArray bindings;
+        for (const auto &item : extraAttributes)
+            bindings += item.first + '=' + QByteArray::number(item.second) + '\0';
+
+        QByteArray key = QCryptographicHash::hash(
+                vertexSource + '\0' + fragmentSource + '\0' + bindings + driverString(),
+                QCryptographicHash::Sha1);
+        QString cacheFile = cacheDir() + key.toHex() + ".bin";
+
+        if (loadBinary(cacheFile)) {
+            state = "hit";
+        } else {
+            state = QFile::exists(cacheFile) ? "stale" : "miss";
+            compileFromSource();
+            saveBinary(cacheFile);
+        }
+    } else {
+        state = "unsupported";
+        compileFromSource();
+    }
+
+    afterLink();
+    Trace::span("shader " + name + " (cache " + state + ")",
+            begin, startupTimer.nsecsElapsed(), "shader");
+}
+
+bool ShaderEffect::loadBinary(const QString &cacheFile)
+{
+    QFile file(cacheFile);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    quint32 format;
+    QByteArray binary;
+    stream >> format >> binary;
+    if (stream.status() != QDataStream::Ok)
+        return false;
+
+    prog = new QOpenGLShaderProgram();
+    prog->create();
+    programBinary(prog->programId(), format, binary.constData(), binary.size());
+
+    // link() only checks the link status when no shader is attached
+    if (!prog->link()) {
+        delete prog;
+        prog = NULL;
+        return false;
+    }
+    return true;
+}
+
+void ShaderEffect::saveBinary(const QString &cacheFile)
+{
+    if (!prog->isLinked()) return;
+
+    QOpenGLFunctions *func = QOpenGLContext::currentContext()->functions();
+    GLint length = 0;
+    func->glGetProgramiv(prog->programId(), GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+
+    QByteArray binary(length, 0);
+    GLenum format;
+    getProgramBinary(prog->programId(), length, NULL, &format, binary.data());
+
+    QDir().mkpath(cacheDir());
+    QFile file(cacheFile);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Failed to write shader cache" << cacheFile;
+        return;
+    }
+    QDataStream stream(&file);
+    stream << quint32(format) << binary;
+}
+
+void ShaderEffect::compileFromSource()
+{
+    prog = new QOpenGLShaderProgram();
+    prog->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexSource);
+    prog->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentSource);
+
+    for (const auto &item : Attributes)
+        prog->bindAttributeLocation(item.name, item.attr);
+    for (const auto &item : extraAttributes)
+        prog->bindAttributeLocation(item.first, item.second);
+
+    if (programParameteri)
+        programParameteri(prog->programId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    if (!prog->link())
+        qDebug() << "Failed to link shader" << name << prog->log();
+}
+
+void ShaderEffect::afterLink()
+{
+    attributes.clear();
+    for (const auto &item : Attributes)
+        if (prog->attributeLocation(item.name) != -1)
+            attributes.append(item.attr);
+
+    mvpLocation = prog->uniformLocation("qt_ModelViewProjectionMatrix");
+    modelViewLocation = prog->uniformLocation("qt_ModelViewMatrix");
+    projectionLocation = prog->uniformLocation("qt_ProjectionMatrix");
+    normalMatrixLocation = prog->uniformLocation("qt_NormalMatrix");
+    lightLocation = prog->uniformLocation("qt_Light.position");
+    colorLocation = prog->uniformLocation("qt_Color");
+
+    prog->bind();
+    prog->setUniformValue("qt_Texture0", 0);
+    prog->setUniformValue("qt_Texture1", 1);
+    prog->release();
+}
@@ -0,0 +1,74 @@
+#ifndef SHADEREFFECT_H
+#define SHADEREFFECT_H
+
+#include <Qt3D/QGLAbstractEffect>
+
+class QOpenGLShaderProgram;
+
+/**
+ * \brief Shader effect with a persistent program binary cache
+ *
+ * A replacement of QGLShaderProgramEffect for the shaders of this program.
+ * It binds the standard qt_* attributes and sets the qt_* uniforms used by
+ * our shaders (matrices, main light position, color and texture samplers).
+ *
+ * QGLShaderProgramEffect always compiles from source, which is slow on
+ * software rasterizers. This class stores the linked program through
+ * glGetProgramBinary in the cache directory, keyed by the hash of both
+ * sources and the vendor, renderer and version strings of the driver.
+ * A cached binary rejected by the driver is recompiled and replaced.
+ *
+ * The program is created on first activation, which is recorded in the
+ * trace together with the cache state (hit, miss, stale or unsupported).
+ */
+
+class ShaderEffect : public QGLAbstractEffect {
+public:
+    ShaderEffect();
+    ~ShaderEffect();
+
+    /// Load vertex shader source from @p fileName.
+    void setVertexShaderFromFile(const QString &fileName);
+    /// Load fragment shader source from @p fileName.
+    void setFragmentShaderFromFile(const QString &fileName);
+
+    /// Bind attribute @p name to @p location besides the qt_* attributes.
+    /// Such attributes are not enabled on activation, the user sets them up.
+    void bindAttributeLocation(const QByteArray &name, int location);
+
+    /// Declare that the shaders output pick colors by themselves,
+    /// so that the effect is also used when painting for picking.
+    inline void setSupportsPicking(bool value) { picking = value; }
+
+    /// Virtual function of QGLAbstractEffect.
+    bool supportsPicking() const { return picking; }
+
+    /// Return the shader program, or NULL if the effect is never activated.
+    inline QOpenGLShaderProgram *program() const { return prog; }
+
+    /// Virtual function required by QGLAbstractEffect.
+    void setActive(QGLPainter *painter, bool flag);
+
+    /// Virtual function required by QGLAbstractEffect.
+    void update(QGLPainter *painter, QGLPainter::Updates updates);
+
+private:
+    void createProgram();
+    bool loadBinary(const QString &cacheFile);
+    void saveBinary(const QString &cacheFile);
+    void compileFromSource();
+    void afterLink();
+
+    QString name;
+    QByteArray vertexSource, fragmentSource;
+    QList<QPair<QByteArray, int> > extraAttributes;
+    bool picking = false;
+
+    QOpenGLShaderProgram *prog = NULL;
+    QList<int> attributes;
+
+    int mvpLocation, modelViewLocation, projectionLocation, normalMatrixLocation;
+    int lightLocation, colorLocation;
+};
+
+#endif
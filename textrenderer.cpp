@@ -0,0 +1,86 @@
+#include "textrenderer.h"
+#include <Qt3D/QGeometryData>
+#include <Qt3D/QGLMaterial>
+#include <Qt3D/QGLSceneNode>
+#include <QtGui/QMatrix4x4>
+#include <QtGui/QPainter>
+
+#include <QtCore/QDebug>
+
+/* Size of the atlas in pixels, enough for a few hundred glyphs */
+static const int AtlasSize = 512;
+
+/* Space around glyphs for the outline and texture filtering */
+static const int Padding = 2;
+
+/* White with a black outline, antialiased */
+static void drawOutlined(QImage &image, const QRect &, const QFont &font, QChar c,
+        const QPointF &pen)
+{
+    QPainterPath path;
+    path.addText(pen, font, QString(c));
+
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setBrush(QColor(Qt::white));
+    painter.setPen(QColor(Qt::black));
+    painter.drawPath(path);
+}
+
+TextRenderer::TextRenderer(const QFont &font) :
+    atlas("glyphs", font, AtlasSize, Padding, QImage::Format_ARGB32_Premultiplied, drawOutlined)
+{
+    root = new QGLSceneNode();
+    root->setMaterial(new QGLMaterial);
+    root->setEffect(QGL::FlatReplaceTexture2D);
+}
+
+void TextRenderer::clear()
+{
+    texts.clear();
+    textChanged = true;
+}
+
+void TextRenderer::addText(const QPointF &pos, const QString &text)
+{
+    texts.append(qMakePair(pos, text));
+    textChanged = true;
+}
+
+QGLSceneNode *TextRenderer::node(const QSize &size)
+{
+    if (textChanged || size != this->size) {
+        this->size = size;
+        if (!buildGeometry()) {
+            // keep only the glyphs in use
+            atlas.clear();
+            if (!buildGeometry())
+                qDebug() << "Glyph atlas full, some characters are not drawn";
+        }
+        textChanged = false;
+    }
+
+    root->material()->setTexture(atlas.texture());
+    return root;
+}
+
+/* Return false if the atlas is full, leaving out the glyphs that
+ * do not fit */
+bool TextRenderer::buildGeometry()
+{
+    QGeometryData geometry;
+    bool complete = true;
+
+    // to normalized device coordinates, y upwards
+    QMatrix4x4 transform;
+    transform.translate(-1, 1);
+    transform.scale(2.0 / size.width(), -2.0 / size.height());
+
+    for (const QPair<QPointF, QString> &text : texts)
+        complete &= atlas.appendText(geometry, text.second, text.first, transform);
+
+    root->setGeometry(geometry);
+    root->setStart(0);
+    root->setCount(geometry.indexCount());
+    return complete;
+}
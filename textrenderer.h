@@ -0,0 +1,51 @@
+#ifndef TEXTRENDERER_H
+#define TEXTRENDERER_H
+
+#include "glyphatlas.h"
+#include <QtCore/QList>
+#include <QtCore/QSize>
+
+class QGLSceneNode;
+
+/**
+ * \brief Screen text drawn as quads from a glyph atlas
+ *
+ * Each character is rasterized once, white with a black outline, into an
+ * atlas texture shared by all text. Text is laid out in pixels like
+ * QPainterPath::addText and drawn by a single node with one quad per
+ * character, so changing the text only rebuilds a few vertices. The
+ * texture is uploaded again only when new characters are added.
+ *
+ * When the atlas is full, it is cleared and filled with the characters
+ * of the current text only. Characters that still do not fit are left out.
+ */
+
+class TextRenderer {
+public:
+    /// Create a renderer of text in @p font.
+    TextRenderer(const QFont &font);
+
+    /// Remove all text.
+    void clear();
+
+    /// Add @p text with baseline starting at @p pos, in pixels from the
+    /// top left corner of the screen.
+    void addText(const QPointF &pos, const QString &text);
+
+    /// Return the node drawing all text on a screen of @p size
+    /// in normalized device coordinates, to be drawn without matrices.
+    QGLSceneNode *node(const QSize &size);
+
+private:
+    bool buildGeometry();
+
+    GlyphAtlas atlas;
+
+    QList<QPair<QPointF, QString> > texts;
+    QSize size;
+    bool textChanged = true;
+
+    QGLSceneNode *root;
+};
+
+#endif
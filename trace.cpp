@@ -0,0 +1,119 @@
+#include "trace.h"
+#include "common.h"
+#include <QtCore/QFile>
+#include <QtCore/QMutex>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QTextStream>
+
+#include <QtCore/QDebug>
+
+namespace {
+
+struct Event {
+    QString name;
+    const char *category;
+    char phase;
+    qint64 begin, end;
+    int thread;
+};
+
+QString fileName;
+QMutex mutex;
+QList<Event> events;
+QList<QThread*> threads;
+
+/* Small stable thread ids, the main thread is 0 */
+int threadIndex()
+{
+    QThread *thread = QThread::currentThread();
+    int index = threads.indexOf(thread);
+    if (index == -1) {
+        index = threads.size();
+        threads.append(thread);
+    }
+    return index;
+}
+
+QString escape(QString str)
+{
+    return str.replace('\\', "\\\\").replace('"', "\\\"");
+}
+
+}
+
+void Trace::init(const QStringList &arguments)
+{
+    fileName = QString::fromLocal8Bit(qgetenv("EXPLORER_TRACE"));
+
+    int index = arguments.indexOf("--trace");
+    if (index != -1 && index + 1 < arguments.size())
+        fileName = arguments.at(index + 1);
+
+    if (isEnabled()) {
+        threads.append(QThread::currentThread());
+        qDebug() << "Writing startup trace to" << fileName;
+    }
+}
+
+bool Trace::isEnabled()
+{
+    return !fileName.isEmpty();
+}
+
+void Trace::span(const QString &name, qint64 begin, qint64 end, const char *category)
+{
+    if (!isEnabled()) return;
+
+    QMutexLocker locker(&mutex);
+    events.append(Event{name, category, 'X', begin, end, threadIndex()});
+}
+
+void Trace::instant(const QString &name, const char *category)
+{
+    if (!isEnabled()) return;
+
+    qint64 now = startupTimer.nsecsElapsed();
+    QMutexLocker locker(&mutex);
+    events.append(Event{name, category, 'i', now, now, threadIndex()});
+}
+
+void Trace::write()
+{
+    if (!isEnabled()) return;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Failed to write trace" << fileName;
+        return;
+    }
+
+    QTextStream out(&file);
+    QMutexLocker locker(&mutex);
+
+    out << "{\"traceEvents\":[\n";
+    for (int i = 0; i < events.size(); ++i) {
+        const Event &e = events.at(i);
+        out << "{\"name\":\"" << escape(e.name)
+            << "\",\"cat\":\"" << e.category
+            << "\",\"ph\":\"" << e.phase
+            << "\",\"pid\":1,\"tid\":" << e.thread
+            << ",\"ts\":" << e.begin / 1000;
+        if (e.phase == 'X')
+            out << ",\"dur\":" << (e.end - e.begin) / 1000;
+        else
+            out << ",\"s\":\"g\"";
+        out << (i + 1 < events.size() ? "},\n" : "}\n");
+    }
+    out << "]}\n";
+}
+
+TraceSpan::TraceSpan(const QString &name, const char *category)
+    : name(name), category(category), begin(startupTimer.nsecsElapsed())
+{
+}
+
+TraceSpan::~TraceSpan()
+{
+    Trace::span(name, begin, startupTimer.nsecsElapsed(), category);
+}
@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QtCore/QString>
+
+class QStringList;
+
+/**
+ * \brief Timing spans written as a Chrome trace file
+ *
+ * Tracing is enabled by the environment variable EXPLORER_TRACE or the
+ * command line option "--trace", both followed by the output file name.
+ * The file can be loaded in chrome://tracing to compare startup phases
+ * across machines and asset changes.
+ *
+ * Timestamps are taken from startupTimer, so the origin of the trace is
+ * the start of main(). Spans may be recorded from any thread.
+ *
+ * When tracing is disabled all functions return immediately.
+ */
+
+class Trace {
+public:
+    /// Enable tracing according to environment and @p arguments.
+    static void init(const QStringList &arguments);
+
+    /// Return true if tracing is enabled.
+    static bool isEnabled();
+
+    /// Record a span named @p name from @p begin to @p end (in nanoseconds).
+    static void span(const QString &name, qint64 begin, qint64 end,
+            const char *category = "startup");
+
+    /// Record a zero-length event named @p name at current time.
+    static void instant(const QString &name, const char *category = "startup");
+
+    /// Write all recorded events to the output file.
+    /// Can be called several times, the file is overwritten.
+    static void write();
+};
+
+/**
+ * \brief Record a span for the lifetime of the object
+ */
+
+class TraceSpan {
+public:
+    TraceSpan(const QString &name, const char *category = "startup");
+    ~TraceSpan();
+
+private:
+    QString name;
+    const char *category;
+    qint64 begin;
+};
+
+#endif
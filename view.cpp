@@ -1,12 +1,29 @@
 #include "view.h"
+#include "backgroundcache.h"
 #include "common.h"
 #include "directory.h"
 #include "outlinepainter.h"
 #include "imageviewer.h"
+#include "labelrenderer.h"
+#include "raypicker.h"
+#include "renderqueue.h"
 #include "room.h"
+#include "textrenderer.h"
+#include "trace.h"
 #include <Qt3D/QGLBuilder>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QFileSystemWatcher>
+#include <QtCore/QTemporaryDir>
 #include <QtMultimedia/QMediaPlayer>
 
+#include <QtCore/QDebug>
+
+/* Frames painted before and during the measurement of each size */
+static const int BenchWarmup = 10;
+static const int BenchFrames = 100;
+
 View::View(int width, int height, const QSurfaceFormat &format) : GLView(format)
 {
     resize(width, height);
@@ -15,7 +32,10 @@ View::View(int width, int height, const QSurfaceFormat &format) : GLView(format)
     windowHeight = height;
 
     curRoom = rooms["room1"];
-    dir = new Directory(curRoom->countSlot());
+    {
+        TraceSpan span("Directory::update");
+        dir = new Directory(curRoom->countSlot());
+    }
 
     defaultCenter = QVector3D(0, eyeHeight, -roomLength / 2);
     defaultEye = QVector3D(0, eyeHeight, 0);
@@ -28,25 +48,39 @@ View::View(int width, int height, const QSurfaceFormat &format) : GLView(format)
 
     setupLight();
     setupAnimation();
+    setupConfigWatcher();
 
     // music player
     mediaPlayer = new QMediaPlayer;
     mediaPlayer->setVolume(30);
 
     // HUD
+    QFont font;
+    font.setPointSize(18);
+    font.setBold(true);
+    hud = new TextRenderer(font);
+    labels = new LabelRenderer(font);
+
+    // last painted scene, see paintCachedScene
     QGLBuilder builder;
     builder.newSection(QGL::Faceted);
     builder.addPane(QSizeF(2, 2));
-    hud = builder.finalizedSceneNode();
-    hud->setMaterial(new QGLMaterial);
-    hud->setEffect(QGL::FlatReplaceTexture2D);
+    sceneQuad = builder.finalizedSceneNode();
+    sceneQuad->setMaterial(new QGLMaterial);
+    sceneQuad->setUserEffect(copyEffect);
 
     /* outline */
     outline = new OutlinePainter;
 
+    queue = new RenderQueue;
+    background = new BackgroundCache;
+    picker = new RayPicker;
+
+    connect(camera(), &QGLCamera::viewChanged, [=]() { invalidate(CameraDirty); });
+    connect(camera(), &QGLCamera::projectionChanged, [=]() { invalidate(CameraDirty); });
+
     curRoom->loadFront(dir);
-    updateHudContent();
-    update();
+    invalidate(AllDirty);
 }
 
 void View::initializeGL(QGLPainter *painter)
@@ -54,8 +88,162 @@ void View::initializeGL(QGLPainter *painter)
     lightId = painter->addLight(light);
 }
 
+void View::exposeEvent(QExposeEvent *event)
+{
+    if (firstFramePresented) {
+        GLView::exposeEvent(event);
+        return;
+    }
+
+    qint64 begin = startupTimer.nsecsElapsed();
+    GLView::exposeEvent(event);
+    if (!firstFramePainted) return;
+
+    // painted and swapped
+    firstFramePresented = true;
+    Trace::span("first frame", begin, startupTimer.nsecsElapsed());
+    Trace::instant("first frame presented");
+    Trace::write();
+}
+
 void View::resizeEvent(QResizeEvent *)
 {
-    updateHudContent();
-    update();
+    invalidate(CameraDirty | HudDirty);
+}
+
+void View::setupConfigWatcher()
+{
+    configWatcher = new QFileSystemWatcher(this);
+    configWatcher->addPath(configDir);
+    configWatcher->addPath(configDir + QString("main.conf"));
+    for (Room *room : rooms)
+        configWatcher->addPath(configDir + room->configFile());
+
+    connect(configWatcher, &QFileSystemWatcher::fileChanged, this, &View::reloadConfig);
+
+    // editors saving by rename make the watcher drop the file
+    connect(configWatcher, &QFileSystemWatcher::directoryChanged,
+            [=](const QString &)
+            {
+                for (Room *room : rooms) {
+                    QString path = configDir + room->configFile();
+                    if (!configWatcher->files().contains(path) && QFile::exists(path)) {
+                        configWatcher->addPath(path);
+                        reloadConfig(path);
+                    }
+                }
+            });
+}
+
+void View::reloadConfig(const QString &path)
+{
+    if (animStage != NoAnim) {
+        if (!pendingReloads.contains(path))
+            pendingReloads.append(path);
+        return;
+    }
+
+    QString fileName = QFileInfo(path).fileName();
+    if (fileName == "main.conf") {
+        qDebug() << "main.conf changed, restart to apply";
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for (Room *room : rooms) {
+        if (room->configFile() != fileName) continue;
+
+        QStringList changed = room->reload();
+        if (changed.isEmpty()) continue;
+
+        if (room == curRoom) {
+            hoverLeave();
+            if (changed.contains("slot")) {
+                pickedEntry = -1;
+                curRoom->pickEntry(-1);
+                dir->setPageSize(curRoom->countSlot());
+                curRoom->loadFront(dir);
+            }
+        }
+
+        qDebug() << "Reloaded" << changed << "of" << fileName
+            << "in" << timer.elapsed() << "ms";
+    }
+
+    invalidate(RoomDirty);
+}
+
+void View::startBenchmark()
+{
+    if (!rooms.contains("bench"))
+        rooms.insert("bench", new Room("bench.conf"));
+    curRoom = rooms["bench"];
+    dir->setPageSize(curRoom->countSlot());
+
+    // all slots in view
+    camera()->setEye(QVector3D(0, 60, 75));
+    camera()->setCenter(QVector3D(0, 60, -80));
+
+    showLabels = true;
+    benchSizes << 100 << 1000 << 10000;
+    nextBenchmark();
+}
+
+void View::nextBenchmark()
+{
+    delete benchDir;
+    benchDir = NULL;
+    if (benchSizes.isEmpty()) {
+        qDebug() << "Benchmark finished";
+        QCoreApplication::quit();
+        return;
+    }
+
+    // empty files of various types, removed with the directory
+    static const char *extensions[] = { "", ".txt", ".jpg", ".mp3", ".mp4" };
+    int size = benchSizes.takeFirst();
+    benchDir = new QTemporaryDir;
+    for (int i = 0; i < size; ++i) {
+        QFile file(QString("%1/%2%3").arg(benchDir->path())
+                .arg(i, 5, 10, QChar('0')).arg(extensions[i % 5]));
+        file.open(QIODevice::WriteOnly);
+    }
+
+    hoverLeave();
+    dir->setPath(benchDir->path());
+    dir->refresh();
+    curRoom->loadFront(dir);
+    benchFrames = 0;
+    invalidate(AllDirty);
+}
+
+void View::stepBenchmark()
+{
+    // paintTime() is of the frame before this one
+    if (benchFrames == BenchWarmup)
+        benchNsecs = 0;
+    else if (benchFrames > BenchWarmup)
+        benchNsecs += paintTime();
+
+    if (benchFrames == BenchWarmup + BenchFrames) {
+        qDebug() << "Benchmark:" << dir->count() << "entries,"
+            << "labels" << (showLabels ? "on," : "off,")
+            << benchNsecs / 1e6 / BenchFrames << "ms per frame, last frame:"
+            << queue->stats();
+
+        // each size again without labels
+        showLabels = !showLabels;
+        benchFrames = 0;
+        if (showLabels)
+            nextBenchmark();
+        else
+            invalidate(RoomDirty);
+        return;
+    }
+
+    // the whole scene in every frame
+    ++benchFrames;
+    invalidate(SceneDirty);
 }
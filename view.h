@@ -3,15 +3,21 @@
 
 #include "lib/glview.h"
 
+class BackgroundCache;
 class Directory;
 class Hud;
+class LabelRenderer;
+class RayPicker;
 class Room;
+class ShaderEffect;
 class Surface;
+class TextRenderer;
 class OutlinePainter;
+class RenderQueue;
 class QGLFramebufferObjectSurface;
-class QGLShaderProgramEffect;
+class QFileSystemWatcher;
 class QMediaPlayer;
-class QVariantAnimation;
+class QTemporaryDir;
 
 enum AnimStage : int;
 
@@ -37,11 +43,37 @@ public:
     /// Create a window of given size.
     View(int width, int height, const QSurfaceFormat &format);
 
+    /// Parts of the frame that may change, see invalidate().
+    enum DirtyFlag {
+        CameraDirty = 0x01,
+        RoomDirty = 0x02,
+        HoverDirty = 0x04,
+        PickedDirty = 0x08,
+        HudDirty = 0x10,
+        ImageDirty = 0x20,
+        SceneDirty = CameraDirty | RoomDirty | PickedDirty | ImageDirty,
+        AllDirty = 0x3f
+    };
+
+    /// Mark @p flags as changed and schedule a frame.
+    /// The scene is painted again only if any of SceneDirty is set,
+    /// otherwise the last one is reused under the outline and HUD.
+    void invalidate(int flags);
+
+    /// Measure the time to paint and swap a frame with 100, 1000 and 10000
+    /// entries in the room of bench.conf, with labels on and off, print the
+    /// results and quit.
+    void startBenchmark();
+
 protected:
     /// Virtual function required by QGLView.
     /// Called once for each buffer.
     void initializeGL(QGLPainter *painter);
 
+    /// Virtual function required by GLView.
+    /// Apply the last mouse move and advance the animation by the frame clock.
+    void prepareFrame(qint64 msecs);
+
     /// Virtual function required by QGLView.
     /// Paint the room and HUD interface.
     void paintGL(QGLPainter *painter);
@@ -58,15 +90,22 @@ protected:
     void mouseReleaseEvent(QMouseEvent *event);
 
     /// Handler for mouse move events.
-    /// Move the item if an item is picked up,
-    /// rotate the camera if is roaming now.
+    /// Only keep the position, applied by prepareFrame once per frame.
     void mouseMoveEvent(QMouseEvent *event);
 
+    /// Virtual function required by GLView.
+    /// Update the hovered object under the mouse.
+    void objectIdReady(const QPoint &point, int objectId);
+
     /// Handler for keyboard shortcuts.
     /// The shortcuts are mainly for debug purpose,
     /// any important actions can be done by mouse.
     void keyPressEvent(QKeyEvent *event);
 
+    /// Paint and present a frame.
+    /// The first presented frame is recorded in startup trace.
+    void exposeEvent(QExposeEvent *event);
+
     /// Resize the window.
     void resizeEvent(QResizeEvent *);
 
@@ -77,37 +116,69 @@ private:
     // constructor helpers
     void setupAnimation();
     void setupLight();
+    void setupConfigWatcher();
+
+    // apply changes of config file at path
+    void reloadConfig(const QString &path);
+
+    // benchmark, driven by prepareFrame
+    void nextBenchmark();
+    void stepBenchmark();
 
     // paintGL helpers
+    void paintScene(QGLPainter *painter);
+    void createSceneBuffer(const QSize &size);
+    void paintCachedScene(QGLPainter *painter);
     void updateCamera();
     void paintCurrentRoom(QGLPainter *painter);
+    void paintBackground(QGLPainter *painter);
     void paintNextRoom(QGLPainter *painter);
-    void paintHud(QGLPainter *painter);
+    void paintNextRoomContent(QGLPainter *painter);
+    void paintImpostor(QGLPainter *painter, const QVector<QVector3D> &corners);
+    void paintHud(QGLPainter *painter, int flags);
 
     void updateHudContent(qreal x = 0, qreal y = 0, QString text = QString());
     void paintOutline(QGLPainter *painter);
+    QRectF hoverBounds();
 
     // left-click actions
     void invokeObject(int id);
     void openEntry(int index);
 
+    // move @p delta pages, sliding if slidePages is set
+    void turnPage(int delta);
+
+    // object under the mouse, by the ray picker or the pick buffer
+    int objectAt(const QPoint &point);
+    void updatePicker();
+    int castPickRay(const QPoint &point);
+
     // hovering control
     void hoverEnter(int obj);
     void hoverLeave();
 
     // animation
     void startAnimation(AnimStage stage);
+    void runAnimation();
     void finishAnimation();
 
     // roaming
     void startRoaming(QPoint pos);
 
+    // move the picked item, rotate the camera if roaming, or update
+    // the hovered object, for the last mouse move
+    void applyMouseMove();
+
     // main members
     Directory *dir;
     Room *curRoom;
     
     QMediaPlayer *mediaPlayer;
 
+    // config hot reload, delayed until animation finished
+    QFileSystemWatcher *configWatcher;
+    QStringList pendingReloads;
+
     // pseudo-const variables
     QVector3D defaultCenter;
     QVector3D defaultEye;
@@ -120,11 +191,52 @@ private:
     bool isNear = false;
 
     // text, outline, etc
-    QGLSceneNode *hud;
+    TextRenderer *hud;
     OutlinePainter *outline;
 
-    QOpenGLFramebufferObject *fbo = NULL;
-    QGLFramebufferObjectSurface *surface = NULL;
+    // names of entries in the room
+    LabelRenderer *labels;
+    bool showLabels = true;
+
+    // draw items of a frame, sorted by state
+    RenderQueue *queue;
+
+    // static parts of the room drawn from a cube map while the eye stays
+    BackgroundCache *background;
+    bool backgroundCached = false;
+
+    // last painted scene, multisampled like the window if possible
+    // and resolved into a texture; reused while only hover or HUD change
+    int dirty = AllDirty;
+    QOpenGLFramebufferObject *sceneFbo = NULL;
+    QOpenGLFramebufferObject *sceneTexFbo = NULL;
+    QGLFramebufferObjectSurface *sceneSurface = NULL;
+    QGLSceneNode *sceneQuad;
+
+    // next room captured once when entering, drawn on the chest opening
+    QOpenGLFramebufferObject *impostorFbo = NULL;
+    QGLFramebufferObjectSurface *impostorSurface = NULL;
+    QMatrix4x4 impostorMatrix;
+    bool impostorValid = false;
+    bool impostorDone = false;
+    int impostorGeneration = 0;
+
+    // objects of the current room for picking on the CPU; the pick
+    // buffer is only rendered for the outline, or if gpuPicking is set
+    RayPicker *picker;
+    bool pickerDirty = true;
+    const Room *pickerRoom = NULL;
+    int pickerRevision = -1;
+    int pickerGeneration = -1;
+    bool gpuPicking = false;
+
+    // mouse moves merged into one per frame, counted for statistics;
+    // changes are painted in the frame being prepared, so applying them
+    // does not schedule another one
+    bool movePending = false;
+    QPoint movePos;
+    bool applyingMove = false;
+    int moveEvents = 0, mergedMoves = 0;
 
     // roaming
     bool isRoaming = false;
@@ -132,13 +244,18 @@ private:
     QVector3D roamStartCenter;
 
     // animation
-    QVariantAnimation *animation;
     AnimStage animStage;
-    qreal animProg;
+    qreal animProg = 0.0;
+    int animDuration;
+    qint64 animStartTime = -1;
 
     int enteringDir = -1;
     int leavingDoor = -1;
 
+    // pages are prepared beside the front one and turned by swapping
+    int slideDelta = 0;
+    bool slidePages = true;
+
     QVector3D startCenter;
     QVector3D startEye;
     QVector3D startUp;
@@ -147,12 +264,24 @@ private:
     QVector3D deltaEye;
     QVector3D deltaUp;
 
+    // benchmark: sizes left, and the directory of the current one
+    QList<int> benchSizes;
+    QTemporaryDir *benchDir = NULL;
+    int benchFrames = 0;
+    qint64 benchNsecs = 0;  // total paint time of the measured frames
+
+    // startup
+    bool firstFramePainted = false;
+    bool firstFramePresented = false;
+
     // light
     QGLLightParameters *light;
     int lightId;
 
-    QGLShaderProgramEffect *phongEffect;
-    QGLShaderProgramEffect *boxEffect;
+    ShaderEffect *phongEffect;
+    ShaderEffect *boxEffect;
+    ShaderEffect *impostorEffect;
+    ShaderEffect *copyEffect;
 };
 
 #endif